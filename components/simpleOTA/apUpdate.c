@@ -1,47 +1,59 @@
 #include "apUpdate.h"
 #include "otaHandler.h"
+#include "dnsServer.h"
+#include "otaUdp.h"
+#include "otaTask.h"
+#include "assetBundle.h"
 
 #include "esp_ota_ops.h"
+#include "esp_app_desc.h"
 #include "esp_err.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-
-// External binary data declarations
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
-extern const uint8_t main_css_start[] asm("_binary_main_css_start");
-extern const uint8_t main_css_end[] asm("_binary_main_css_end");
-extern const uint8_t main_js_start[] asm("_binary_main_js_start");
-extern const uint8_t main_js_end[] asm("_binary_main_js_end");
-extern const uint8_t logo_png_start[] asm("_binary_logo_png_start");
-extern const uint8_t logo_png_end[] asm("_binary_logo_png_end");
+#include <strings.h>
 
 uint8_t otaInfoBytes[5] = {OTA_FIRMWARE_DEFAULT, OTA_AP_LAUNCHED, OTA_DEVICE_CONNECTED, OTA_FIRMWARE_UPLOADED, OTA_FIRMWARE_DONE};
 
 // AP state
 static esp_netif_t *ap_netif = NULL;
 static esp_netif_t *sta_netif = NULL;
+static bool sta_netif_owned = false; // Created here, not the application's own
 static esp_event_handler_instance_t wifi_event_handler_instance = NULL;
+static esp_event_handler_instance_t ip_event_handler_instance = NULL;
+
+// STA state, used by the pull/mirror modes
+#define STA_CONNECTED_BIT (1 << 0)
+#define STA_FAILED_BIT (1 << 1)
+#define STA_MAX_RETRIES 5
+static EventGroupHandle_t sta_event_group = NULL;
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+static StaticEventGroup_t sta_event_group_buffer;
+#endif
+static int sta_retry_count = 0;
+// The application was already on Wi-Fi, the pull used its link and must leave it up
+static bool sta_borrowed = false;
 
 // Timeout management
 static TaskHandle_t timeout_task_handle = NULL;
 static bool ap_timeout_active = false;
 
+// Captive portal metrics: time from a client associating to it loading the portal page
+static volatile int64_t client_connected_us = 0;
+static volatile int64_t portal_latency_ms = -1;
+
+// Cleared again by deinit_ap_mdns() so the next start re-initialises mDNS
+static bool mdns_initialised = false;
+
 #define AP_TIMEOUT_MS (CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES * 60 * 1000)
 
 // Handle AP timeout
 static void ap_timeout_task(void *pvParameters)
 {
-    if (CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES == 0) {
-      ESP_LOGI("AP_TIMEOUT", "AP timeout disabled (0 minutes set in config). AP will run indefinitely until stopped manually.");
-      vTaskDelete(NULL);
-      return;
-    }
-
     ESP_LOGI("AP_TIMEOUT", "AP timeout task started. Will shutdown AP in %d minutes", CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES);
 
     vTaskDelay(pdMS_TO_TICKS(AP_TIMEOUT_MS));
@@ -49,46 +61,56 @@ static void ap_timeout_task(void *pvParameters)
     if (ap_timeout_active)
     {
         ESP_LOGW("AP_TIMEOUT", "AP timeout reached (%d minutes). Automatically shutting down AP update mode", CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES);
-        apUpdate_stop();
+        // Clear first, otherwise apUpdate_stop() deletes this task half way through
         ap_timeout_active = false;
         timeout_task_handle = NULL;
+        apUpdate_stop();
     }
 
-    vTaskDelete(NULL);
+    otaTask_exit();
 }
 
-void apUpdate_task(void *pvParameters)
+void apUpdate_start(void)
 {
     apUpdate_startAP(CONFIG_SIMPLE_OTA_AP_SSID);
     vTaskDelay(pdMS_TO_TICKS(1000));
     apUpdate_initMdns(CONFIG_SIMPLE_OTA_HOSTNAME);
     apUpdate_startWebserver();
 
+    if (CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES == 0)
+    {
+        ESP_LOGI("AP_TIMEOUT", "AP timeout disabled (0 minutes set in config). AP will run indefinitely until stopped manually.");
+        return;
+    }
+
     ap_timeout_active = true;
-    BaseType_t xReturned = xTaskCreate(
+    esp_err_t err = otaTask_create(
         ap_timeout_task,
         "ap_timeout",
-        4096, // Stack size
+        OTA_TASK_STACK_AP_TIMEOUT,
         NULL, // Parameters
-        1,    // Priority
+        OTA_TASK_PRIORITY_BACKGROUND,
         &timeout_task_handle);
 
-    if (xReturned == pdPASS)
+    if (err == ESP_OK)
     {
         ESP_LOGI("AP_TIMEOUT", "Timeout task created successfully. AP will auto-shutdown in %d minutes", CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES);
     }
     else
     {
         ESP_LOGE("AP_TIMEOUT", "Failed to create timeout task");
+        ap_timeout_active = false;
     }
+}
 
-    vTaskDelete(NULL);
+void apUpdate_task(void *pvParameters)
+{
+    apUpdate_start();
+    otaTask_exit();
 }
 
 void apUpdate_initMdns(const char *hostname)
 {
-    static bool mdns_initialised = false;
-
     const char *mdns_hostname = hostname ? hostname : CONFIG_SIMPLE_OTA_HOSTNAME;
 
     if (mdns_initialised)
@@ -112,7 +134,8 @@ void apUpdate_initMdns(const char *hostname)
     ESP_LOGI("MDNS", "mDNS service started successfully with hostname: %s.local", mdns_hostname);
 }
 
-void apUpdate_startAP(char *networkName)
+// Event loop, netif and driver setup shared by AP and STA modes
+static void wifi_init_common(void)
 {
     esp_err_t ret = esp_event_loop_create_default();
     if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
@@ -128,7 +151,13 @@ void apUpdate_startAP(char *networkName)
 
     if (sta_netif == NULL)
     {
-        sta_netif = esp_netif_create_default_wifi_sta();
+        // An application on Wi-Fi already has the default STA netif, a second one would clash
+        sta_netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+        sta_netif_owned = sta_netif == NULL;
+        if (sta_netif_owned)
+        {
+            sta_netif = esp_netif_create_default_wifi_sta();
+        }
     }
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -138,6 +167,16 @@ void apUpdate_startAP(char *networkName)
         ESP_ERROR_CHECK(ret);
     }
 
+    if (wifi_event_handler_instance == NULL)
+    {
+        esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &apUpdate_wifiEventHandler, NULL, &wifi_event_handler_instance);
+    }
+}
+
+void apUpdate_startAP(char *networkName)
+{
+    wifi_init_common();
+
     if (ap_netif == NULL)
     {
         ap_netif = esp_netif_create_default_wifi_ap();
@@ -150,21 +189,27 @@ void apUpdate_startAP(char *networkName)
 
         esp_netif_dhcps_stop(ap_netif);
         ESP_ERROR_CHECK(esp_netif_set_ip_info(ap_netif, &ip_info));
+
+#if CONFIG_SIMPLE_OTA_CAPTIVE_DNS
+        // Hand out the AP itself as DNS server so every lookup lands on the portal
+        esp_netif_dns_info_t dns_info = {
+            .ip.u_addr.ip4.addr = ip_info.ip.addr,
+            .ip.type = ESP_IPADDR_TYPE_V4};
+        uint8_t dns_offer = 1;
+        esp_netif_set_dns_info(ap_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+        esp_netif_dhcps_option(ap_netif, ESP_NETIF_OP_SET, ESP_NETIF_DOMAIN_NAME_SERVER, &dns_offer, sizeof(dns_offer));
+#endif
+
         esp_netif_dhcps_start(ap_netif);
 
         ESP_LOGI("wifiAP", "AP configured with custom IP: 10.0.0.1");
     }
 
-    if (wifi_event_handler_instance == NULL)
-    {
-        esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &apUpdate_wifiEventHandler, NULL, &wifi_event_handler_instance);
-    }
-
     wifi_config_t wifi_config = {
         .ap = {
             .ssid_len = strlen(networkName),
             .password = "",
-            .max_connection = 1,
+            .max_connection = CONFIG_SIMPLE_OTA_AP_MAX_CONNECTIONS,
             .authmode = WIFI_AUTH_OPEN},
     };
 
@@ -195,11 +240,14 @@ void apUpdate_startAP(char *networkName)
 
 void apUpdate_wifiEventHandler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
+    // Read once, apUpdate_stopSta() clears it from another task
+    EventGroupHandle_t group = sta_event_group;
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED)
     {
         wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
         ESP_LOGI("wifiAP", "Device connected with MAC: %02x:%02x:%02x:%02x:%02x:%02x",
                  event->mac[0], event->mac[1], event->mac[2], event->mac[3], event->mac[4], event->mac[5]);
+        client_connected_us = esp_timer_get_time();
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED)
     {
@@ -207,97 +255,219 @@ void apUpdate_wifiEventHandler(void *arg, esp_event_base_t event_base, int32_t e
         ESP_LOGI("wifiAP", "Device disconnected with MAC: %02x:%02x:%02x:%02x:%02x:%02x",
                  event->mac[0], event->mac[1], event->mac[2], event->mac[3], event->mac[4], event->mac[5]);
     }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED && group != NULL)
+    {
+        xEventGroupClearBits(group, STA_CONNECTED_BIT);
+        if (sta_retry_count < STA_MAX_RETRIES)
+        {
+            sta_retry_count++;
+            ESP_LOGW("wifiSTA", "Disconnected, retrying (%d/%d)", sta_retry_count, STA_MAX_RETRIES);
+            esp_wifi_connect();
+        }
+        else
+        {
+            xEventGroupSetBits(group, STA_FAILED_BIT);
+        }
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP && group != NULL)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("wifiSTA", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        sta_retry_count = 0;
+        xEventGroupSetBits(group, STA_CONNECTED_BIT);
+    }
 }
 
-// GET handler to serve the HTML page
-esp_err_t get_handler(httpd_req_t *req)
+esp_err_t apUpdate_startSta(const char *ssid, const char *password, uint32_t timeout_ms)
 {
-    httpd_resp_set_type(req, "text/html");
-    
-    // Create a mutable copy of the HTML to perform replacements
-    const size_t html_size = index_html_end - index_html_start;
-    char* html_content = malloc(html_size + 1024); // Extra space for replacements
-    if (!html_content) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    if (ssid == NULL || strlen(ssid) == 0 || strlen(ssid) > 32)
+    {
+        return ESP_ERR_INVALID_ARG;
     }
-    
-    memcpy(html_content, index_html_start, html_size);
-    html_content[html_size] = '\0';
-    
-    // Replace title placeholder
-    char* title_pos = strstr(html_content, "{{PAGE_TITLE}}");
-    if (title_pos) {
-        size_t title_len = strlen(CONFIG_SIMPLE_OTA_WEB_PAGE_TITLE);
-        memmove(title_pos + title_len, title_pos + 14, strlen(title_pos + 14) + 1);
-        memcpy(title_pos, CONFIG_SIMPLE_OTA_WEB_PAGE_TITLE, title_len);
+
+    // Already on site Wi-Fi: pull over the application's link without touching its mode or config
+    esp_netif_t *app_sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    wifi_mode_t mode;
+    wifi_ap_record_t ap_info;
+    esp_netif_ip_info_t ip_info;
+    if (app_sta != NULL && esp_wifi_get_mode(&mode) == ESP_OK && (mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA) &&
+        esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK && esp_netif_is_netif_up(app_sta) &&
+        esp_netif_get_ip_info(app_sta, &ip_info) == ESP_OK && ip_info.ip.addr != 0)
+    {
+        ESP_LOGI("wifiSTA", "Already connected to %s, pulling over the existing link", (const char *)ap_info.ssid);
+        sta_borrowed = true;
+        return ESP_OK;
     }
-    
-    // Replace footer placeholder
-    char* footer_pos = strstr(html_content, "{{PAGE_FOOTER}}");
-    if (footer_pos) {
-        size_t footer_len = strlen(CONFIG_SIMPLE_OTA_WEB_PAGE_FOOTER);
-        memmove(footer_pos + footer_len, footer_pos + 15, strlen(footer_pos + 15) + 1);
-        memcpy(footer_pos, CONFIG_SIMPLE_OTA_WEB_PAGE_FOOTER, footer_len);
+
+    wifi_init_common();
+
+    if (sta_event_group == NULL)
+    {
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+        sta_event_group = xEventGroupCreateStatic(&sta_event_group_buffer);
+#else
+        sta_event_group = xEventGroupCreate();
+#endif
+        if (sta_event_group == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
     }
-    
-    httpd_resp_send(req, html_content, strlen(html_content));
-    free(html_content);
-    return ESP_OK;
+    xEventGroupClearBits(sta_event_group, STA_CONNECTED_BIT | STA_FAILED_BIT);
+    sta_retry_count = 0;
+
+    if (ip_event_handler_instance == NULL)
+    {
+        esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &apUpdate_wifiEventHandler, NULL, &ip_event_handler_instance);
+    }
+
+    wifi_config_t wifi_config = {0};
+    memcpy(wifi_config.sta.ssid, ssid, strlen(ssid));
+    if (password != NULL && strlen(password) >= 8)
+    {
+        strncpy((char *)wifi_config.sta.password, password, sizeof(wifi_config.sta.password) - 1);
+        wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    }
+    else
+    {
+        wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    ESP_LOGI("wifiSTA", "Connecting to %s", ssid);
+
+    EventBits_t bits = xEventGroupWaitBits(sta_event_group, STA_CONNECTED_BIT | STA_FAILED_BIT,
+                                           pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    if (bits & STA_CONNECTED_BIT)
+    {
+        return ESP_OK;
+    }
+
+    ESP_LOGW("wifiSTA", "Could not connect to %s", ssid);
+    apUpdate_stopSta();
+    return (bits & STA_FAILED_BIT) ? ESP_FAIL : ESP_ERR_TIMEOUT;
 }
 
-esp_err_t css_handler(httpd_req_t *req)
+void apUpdate_stopSta(void)
 {
-    httpd_resp_set_type(req, "text/css");
-    
-    // First send the dynamic colour variables
-    char color_css[512];
-    snprintf(color_css, sizeof(color_css), 
-             ":root {\n"
-             "  --primary-colour: #%06x;\n"
-             "  --secondary-colour: #%06x;\n"
-             "  --background-colour: #%06x;\n"
-             "}\n", 
-             CONFIG_SIMPLE_OTA_WEB_PAGE_PRIMARY_COLOUR & 0xFFFFFF,
-             CONFIG_SIMPLE_OTA_WEB_PAGE_SECONDARY_COLOUR & 0xFFFFFF,
-             CONFIG_SIMPLE_OTA_WEB_PAGE_BACKGROUND_COLOUR & 0xFFFFFF);
-    httpd_resp_send_chunk(req, color_css, strlen(color_css));
-    
-    // Then send the main CSS file
-    const size_t css_size = main_css_end - main_css_start;
-    httpd_resp_send_chunk(req, (const char *)main_css_start, css_size);
-    
-    // End the chunked response
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+    if (sta_borrowed)
+    {
+        // Not ours to stop, the application stays connected
+        sta_borrowed = false;
+        return;
+    }
+
+    // Handlers stop seeing the group first, then are unregistered: unregistering waits for
+    // a running handler, so none can still be setting bits when the group is deleted
+    EventGroupHandle_t group = sta_event_group;
+    sta_event_group = NULL;
+    sta_retry_count = STA_MAX_RETRIES;
+    if (ip_event_handler_instance != NULL)
+    {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, ip_event_handler_instance);
+        ip_event_handler_instance = NULL;
+    }
+    // Registered again by wifi_init_common() when Wi-Fi is next started
+    if (wifi_event_handler_instance != NULL)
+    {
+        esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler_instance);
+        wifi_event_handler_instance = NULL;
+    }
+
+    esp_wifi_disconnect();
+    esp_wifi_stop();
+
+    if (group != NULL)
+    {
+        vEventGroupDelete(group);
+    }
+
+    ESP_LOGI("wifiSTA", "Station mode stopped");
 }
 
-esp_err_t js_handler(httpd_req_t *req)
+// Kconfig settings the page needs, rendered once by render_page_config()
+static char page_theme[160];
+static char page_config[160];
+
+// Placeholders in index.html and what replaces them
+static const struct
 {
-    httpd_resp_set_type(req, "application/javascript");
-    
-    // First send the configuration variables
-    char config_js[512];
-    snprintf(config_js, sizeof(config_js), 
-             "const CONFIG_MAX_FILE_SIZE_MB = %d;\n"
-             "const CONFIG_AUTO_REBOOT = %s;\n"
-             "const CONFIG_TIMEOUT_MINUTES = %d;\n", 
+    const char *key;
+    const char *value;
+} page_placeholders[] = {
+    {"{{PAGE_TITLE}}", CONFIG_SIMPLE_OTA_WEB_PAGE_TITLE},
+    {"{{PAGE_FOOTER}}", CONFIG_SIMPLE_OTA_WEB_PAGE_FOOTER},
+    {"{{PAGE_THEME}}", page_theme},
+    {"{{PAGE_CONFIG}}", page_config},
+};
+
+static void render_page_config(void)
+{
+    snprintf(page_theme, sizeof(page_theme),
+             ":root { --primary-colour: #%06x; --secondary-colour: #%06x; --background-colour: #%06x; }",
+             CONFIG_SIMPLE_OTA_WEB_PAGE_PRIMARY_COLOUR & 0xFFFFFF,
+             CONFIG_SIMPLE_OTA_WEB_PAGE_SECONDARY_COLOUR & 0xFFFFFF,
+             CONFIG_SIMPLE_OTA_WEB_PAGE_BACKGROUND_COLOUR & 0xFFFFFF);
+    snprintf(page_config, sizeof(page_config),
+             "const CONFIG_MAX_FILE_SIZE_MB = %d; const CONFIG_AUTO_REBOOT = %s; const CONFIG_TIMEOUT_MINUTES = %d;",
              CONFIG_SIMPLE_OTA_MAX_FILE_SIZE_MB,
              CONFIG_SIMPLE_OTA_AUTO_REBOOT ? "true" : "false",
              CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES);
-    httpd_resp_send_chunk(req, config_js, strlen(config_js));
-    
-    // Then send the main JavaScript file
-    const size_t js_size = main_js_end - main_js_start;
-    httpd_resp_send_chunk(req, (const char *)main_js_start, js_size);
-    
-    // End the chunked response
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+}
+
+// Stream a template straight from flash, substituting placeholders between chunks
+static esp_err_t send_template(httpd_req_t *req, const asset_t *asset)
+{
+    const char *page = (const char *)asset->data;
+    const char *page_end = page + asset->length;
+    const char *sent = page;
+    for (const char *pos = page; pos + 1 < page_end; pos++)
+    {
+        if (pos[0] != '{' || pos[1] != '{')
+        {
+            continue;
+        }
+
+        const char *value = NULL;
+        size_t key_len = 0;
+        for (size_t i = 0; i < sizeof(page_placeholders) / sizeof(page_placeholders[0]); i++)
+        {
+            size_t len = strlen(page_placeholders[i].key);
+            if ((size_t)(page_end - pos) >= len && memcmp(pos, page_placeholders[i].key, len) == 0)
+            {
+                value = page_placeholders[i].value;
+                key_len = len;
+                break;
+            }
+        }
+        if (!value)
+        {
+            continue;
+        }
+
+        httpd_resp_send_chunk(req, sent, pos - sent);
+        httpd_resp_send_chunk(req, value, strlen(value));
+        pos += key_len - 1;
+        sent = pos + 1;
+    }
+    httpd_resp_send_chunk(req, sent, page_end - sent);
+
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 esp_err_t redirect_handler(httpd_req_t *req)
 {
+    // OS connectivity checks (/generate_204, /hotspot-detect.html, /connecttest.txt, ...)
+    // land here via the captive DNS; any non-expected answer makes the OS open the portal
+    ESP_LOGD("CAPTIVE", "Redirecting %s to portal", req->uri);
+
     // Redirect all requests to the root page with custom IP
     httpd_resp_set_status(req, "302 Found");
     httpd_resp_set_hdr(req, "Location", "http://10.0.0.1/");
@@ -305,12 +475,94 @@ esp_err_t redirect_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-esp_err_t logo_handler(httpd_req_t *req)
+// Accept-Encoding allows gzip: absent, "gzip" or "*" without q=0 (RFC 9110 12.5.3)
+static bool accepts_gzip(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "image/png");
-    const size_t logo_size = logo_png_end - logo_png_start;
-    httpd_resp_send(req, (const char *)logo_png_start, logo_size);
-    return ESP_OK;
+    char value[128];
+    size_t len = httpd_req_get_hdr_value_len(req, "Accept-Encoding");
+    if (len == 0 || len >= sizeof(value))
+    {
+        // No header means any coding, an overlong one is a browser listing everything
+        return true;
+    }
+    httpd_req_get_hdr_value_str(req, "Accept-Encoding", value, sizeof(value));
+
+    bool accepted = false;
+    char *save = NULL;
+    for (char *item = strtok_r(value, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        item += strspn(item, " \t");
+        size_t name_len = strcspn(item, " \t;");
+        bool gzip = name_len == 4 && strncasecmp(item, "gzip", 4) == 0;
+        if (!gzip && !(name_len == 1 && item[0] == '*'))
+        {
+            continue;
+        }
+        const char *q = strstr(item, "q=");
+        bool refused = q && strtod(q + 2, NULL) == 0.0;
+        if (gzip)
+        {
+            // An explicit gzip entry overrides "*"
+            return !refused;
+        }
+        accepted = !refused;
+    }
+    return accepted;
+}
+
+// Every GET that no API handler claimed: serve it from the asset bundle, or treat it as a captive probe
+esp_err_t asset_handler(httpd_req_t *req)
+{
+    const int64_t start_us = esp_timer_get_time();
+    asset_t asset;
+    if (assetBundle_find(req->uri, strcspn(req->uri, "?#"), &asset) != ESP_OK)
+    {
+        return redirect_handler(req);
+    }
+    ESP_LOGD("ASSETS", "Routed %s in %lld us", req->uri, (long long)(esp_timer_get_time() - start_us));
+
+    // Compressed files have no plain copy to fall back on
+    if ((asset.flags & ASSET_FLAG_GZIP) && !accepts_gzip(req))
+    {
+        httpd_resp_set_status(req, "406 Not Acceptable");
+        httpd_resp_set_type(req, "text/plain");
+        return httpd_resp_sendstr(req, "This file is only stored gzip-compressed");
+    }
+
+    // First page load after association is when the captive portal popped up
+    if ((asset.flags & ASSET_FLAG_TEMPLATE) && client_connected_us != 0)
+    {
+        portal_latency_ms = (esp_timer_get_time() - client_connected_us) / 1000;
+        client_connected_us = 0;
+        ESP_LOGI("CAPTIVE", "Portal served %lld ms after client association", (long long)portal_latency_ms);
+    }
+
+    // Templates embed Kconfig values, so the firmware hash is part of every tag
+    const uint8_t *sha = esp_app_get_description()->app_elf_sha256;
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%08lx-%02x%02x%02x%02x\"", (unsigned long)asset.etag, sha[0], sha[1], sha[2], sha[3]);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char if_none_match[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        strstr(if_none_match, etag) != NULL)
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset.mime_type);
+    if (asset.flags & ASSET_FLAG_GZIP)
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+    if (asset.flags & ASSET_FLAG_TEMPLATE)
+    {
+        return send_template(req, &asset);
+    }
+    return httpd_resp_send(req, (const char *)asset.data, asset.length);
 }
 
 static httpd_handle_t server = NULL;
@@ -320,54 +572,77 @@ void apUpdate_startWebserver(void)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
     config.stack_size = 8192;
-    config.task_priority = 5;
-    config.max_uri_handlers = 10;
+    config.task_priority = OTA_TASK_PRIORITY_NET;
+    config.core_id = OTA_TASK_CORE;
+    // Six API handlers and the asset router, UI files do not need slots of their own
+    config.max_uri_handlers = 8;
     config.max_resp_headers = 8;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    // Phones open several probe connections at once, recycle the oldest instead of refusing
+    config.lru_purge_enable = true;
+
+    render_page_config();
+    assetBundle_init();
 
     ESP_ERROR_CHECK(httpd_start(&server, &config));
 
-    httpd_uri_t uri_get = {
-        .uri = "/",
-        .method = HTTP_GET,
-        .handler = get_handler,
+    httpd_uri_t uri_ota_update = {
+        .uri = "/ota_update",
+        .method = HTTP_POST,
+        .handler = otaHandler_updatePostHandler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_get);
+    httpd_register_uri_handler(server, &uri_ota_update);
 
-    httpd_uri_t uri_css = {
-        .uri = "/main.css",
-        .method = HTTP_GET,
-        .handler = css_handler,
+    httpd_uri_t uri_activate = {
+        .uri = "/activate",
+        .method = HTTP_POST,
+        .handler = otaHandler_activatePostHandler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_css);
+    httpd_register_uri_handler(server, &uri_activate);
 
-    httpd_uri_t uri_js = {
-        .uri = "/main.js",
+    httpd_uri_t uri_firmware = {
+        .uri = "/firmware",
         .method = HTTP_GET,
-        .handler = js_handler,
+        .handler = otaHandler_firmwareGetHandler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_js);
+    httpd_register_uri_handler(server, &uri_firmware);
 
-    httpd_uri_t uri_ota_update = {
-        .uri = "/ota_update",
-        .method = HTTP_POST,
-        .handler = otaHandler_updatePostHandler,
+    httpd_uri_t uri_info = {
+        .uri = "/info",
+        .method = HTTP_GET,
+        .handler = otaHandler_infoGetHandler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_ota_update);
+    httpd_register_uri_handler(server, &uri_info);
 
-    httpd_uri_t uri_logo = {
-        .uri = "/logo.png",
+    httpd_uri_t uri_slots = {
+        .uri = "/slots",
         .method = HTTP_GET,
-        .handler = logo_handler,
+        .handler = otaHandler_slotsGetHandler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_logo);
+    httpd_register_uri_handler(server, &uri_slots);
 
-    // Catch-all
-    httpd_uri_t uri_redirect = {
+    httpd_uri_t uri_slot_switch = {
+        .uri = "/slot_switch",
+        .method = HTTP_POST,
+        .handler = otaHandler_slotSwitchPostHandler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &uri_slot_switch);
+
+    // Everything else, UI assets and captive portal probes. Must be registered last.
+    httpd_uri_t uri_assets = {
         .uri = "/*",
         .method = HTTP_GET,
-        .handler = redirect_handler,
+        .handler = asset_handler,
         .user_ctx = NULL};
-    httpd_register_uri_handler(server, &uri_redirect);
+    httpd_register_uri_handler(server, &uri_assets);
+
+#if CONFIG_SIMPLE_OTA_CAPTIVE_DNS
+    esp_netif_ip_info_t ip_info;
+    if (ap_netif != NULL && esp_netif_get_ip_info(ap_netif, &ip_info) == ESP_OK)
+    {
+        dnsServer_start(ip_info.ip.addr);
+    }
+#endif
 }
 
 void stop_webserver(void)
@@ -382,7 +657,12 @@ void stop_webserver(void)
 
 void deinit_ap_mdns(void)
 {
+    if (!mdns_initialised)
+    {
+        return;
+    }
     mdns_free();
+    mdns_initialised = false;
     ESP_LOGI("MDNS", "mDNS deinitialised");
 }
 
@@ -402,11 +682,12 @@ void deinit_ap_wifi(void)
         ap_netif = NULL;
     }
 
-    if (sta_netif != NULL)
+    if (sta_netif != NULL && sta_netif_owned)
     {
         esp_netif_destroy_default_wifi(sta_netif);
-        sta_netif = NULL;
     }
+    sta_netif = NULL;
+    sta_netif_owned = false;
 
     ESP_LOGI("WIFI", "Wi-Fi stopped and cleaned up");
 }
@@ -417,10 +698,13 @@ void apUpdate_stop(void)
     {
         ESP_LOGI("AP_TIMEOUT", "Cancelling AP timeout task");
         ap_timeout_active = false;
-        vTaskDelete(timeout_task_handle);
+        otaTask_delete(timeout_task_handle);
         timeout_task_handle = NULL;
     }
 
+    // The UDP transport is bound to the AP, it goes with it (including on AP timeout)
+    otaUdp_stop();
+    dnsServer_stop();
     stop_webserver();
 
     deinit_ap_mdns();
@@ -436,7 +720,7 @@ void apUpdate_cancelTimeout(void)
     {
         ESP_LOGI("AP_TIMEOUT", "Manually cancelling AP timeout");
         ap_timeout_active = false;
-        vTaskDelete(timeout_task_handle);
+        otaTask_delete(timeout_task_handle);
         timeout_task_handle = NULL;
     }
 }
@@ -445,3 +729,8 @@ bool apUpdate_isTimeoutActive(void)
 {
     return ap_timeout_active;
 }
+
+int64_t apUpdate_getPortalLatencyMs(void)
+{
+    return portal_latency_ms;
+}
@@ -0,0 +1,169 @@
+#include "assetBundle.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "ASSET_BUNDLE";
+
+// Generated from data/ by tools/pack_assets.py and embedded by the application
+extern const uint8_t assets_bin_start[] asm("_binary_assets_bin_start");
+extern const uint8_t assets_bin_end[] asm("_binary_assets_bin_end");
+
+typedef struct __attribute__((packed))
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t asset_count;
+    uint16_t table_size;
+    uint16_t max_probe;
+    uint32_t bundle_size;
+} bundle_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t path_hash;
+    uint32_t path_offset;
+    uint32_t data_offset;
+    uint32_t data_length;
+    uint32_t etag;
+    uint8_t mime;
+    uint8_t flags;
+    uint16_t path_length;
+} bundle_entry_t;
+
+// Same order as MIME_TYPES in tools/pack_assets.py
+static const char *const mime_types[] = {
+    "application/octet-stream",
+    "text/html",
+    "text/css",
+    "application/javascript",
+    "image/png",
+    "image/svg+xml",
+    "image/x-icon",
+    "application/json",
+    "text/plain",
+};
+
+static const bundle_entry_t *table = NULL;
+static uint16_t table_mask = 0;
+static uint16_t max_probe = 0;
+
+static uint32_t fnv1a(const char *data, size_t len)
+{
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)data[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+esp_err_t assetBundle_init(void)
+{
+    const size_t size = assets_bin_end - assets_bin_start;
+    const bundle_header_t *header = (const bundle_header_t *)assets_bin_start;
+
+    table = NULL;
+    if (size < sizeof(*header) || memcmp(header->magic, ASSET_BUNDLE_MAGIC, 4) != 0 ||
+        header->version != ASSET_BUNDLE_VERSION)
+    {
+        ESP_LOGE(TAG, "Embedded asset bundle is missing or from another version of pack_assets.py");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header->table_size == 0 || (header->table_size & (header->table_size - 1)) != 0 ||
+        header->bundle_size > size || sizeof(*header) + header->table_size * sizeof(bundle_entry_t) > size)
+    {
+        ESP_LOGE(TAG, "Embedded asset bundle is corrupt");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Offsets are checked here once so lookups can trust them
+    const bundle_entry_t *entries = (const bundle_entry_t *)(assets_bin_start + sizeof(*header));
+    for (size_t i = 0; i < header->table_size; i++)
+    {
+        const bundle_entry_t *entry = &entries[i];
+        if (!(entry->flags & ASSET_FLAG_USED))
+        {
+            continue;
+        }
+        if ((size_t)entry->path_offset + entry->path_length > header->bundle_size ||
+            (size_t)entry->data_offset + entry->data_length > header->bundle_size)
+        {
+            ESP_LOGE(TAG, "Asset entry %u points outside the bundle", (unsigned)i);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    table = entries;
+    table_mask = header->table_size - 1;
+    max_probe = header->max_probe;
+    ESP_LOGI(TAG, "%u routes in a %u byte bundle", header->asset_count, (unsigned)header->bundle_size);
+    return ESP_OK;
+}
+
+esp_err_t assetBundle_find(const char *path, size_t path_len, asset_t *asset)
+{
+    if (!table)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const uint32_t hash = fnv1a(path, path_len);
+    for (uint16_t probe = 0; probe < max_probe; probe++)
+    {
+        const bundle_entry_t *entry = &table[(hash + probe) & table_mask];
+        if (!(entry->flags & ASSET_FLAG_USED))
+        {
+            break;
+        }
+        // The hash only picks the slot, the path comparison decides the match
+        if (entry->path_hash != hash || entry->path_length != path_len ||
+            memcmp(assets_bin_start + entry->path_offset, path, path_len) != 0)
+        {
+            continue;
+        }
+
+        asset->path = (const char *)assets_bin_start + entry->path_offset;
+        asset->path_len = entry->path_length;
+        asset->data = assets_bin_start + entry->data_offset;
+        asset->length = entry->data_length;
+        asset->etag = entry->etag;
+        asset->mime_type = entry->mime < sizeof(mime_types) / sizeof(mime_types[0]) ? mime_types[entry->mime] : mime_types[0];
+        asset->flags = entry->flags;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+uint32_t assetBundle_benchmarkLookupNs(uint32_t iterations)
+{
+    static const char miss[] = "/generate_204";
+    if (!table || iterations == 0)
+    {
+        return 0;
+    }
+
+    asset_t asset;
+    uint32_t lookups = 0;
+    const int64_t start_us = esp_timer_get_time();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        for (size_t i = 0; i <= table_mask; i++)
+        {
+            if (table[i].flags & ASSET_FLAG_USED)
+            {
+                assetBundle_find((const char *)assets_bin_start + table[i].path_offset, table[i].path_length, &asset);
+                lookups++;
+            }
+        }
+        // Captive portal probes are the common miss
+        assetBundle_find(miss, sizeof(miss) - 1, &asset);
+        lookups++;
+    }
+    const int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    uint32_t ns = (uint32_t)(elapsed_us * 1000 / lookups);
+    ESP_LOGI(TAG, "%lu lookups, %lu ns each", (unsigned long)lookups, (unsigned long)ns);
+    return ns;
+}
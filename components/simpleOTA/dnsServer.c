@@ -0,0 +1,238 @@
+#include "dnsServer.h"
+#include "otaTask.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "DNS_SERVER";
+
+#define DNS_HEADER_SIZE 12
+#define DNS_ANSWER_SIZE 16
+#define DNS_TYPE_A 1
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+#define DNS_OPCODE_MASK 0x7800
+#define DNS_RCODE_FORMERR 1
+#define DNS_RCODE_NOTIMP 4
+
+// Fixed footprint: one packet buffer and one task stack, nothing allocated per query
+static uint8_t dns_packet[DNS_SERVER_MAX_PACKET];
+static TaskHandle_t dns_task_handle = NULL;
+static volatile bool dns_running = false;
+static uint32_t dns_answer_ip = 0;
+
+static uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void write_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+// Returns offset just past the question's QNAME, or 0 if malformed
+static size_t skip_qname(const uint8_t *packet, size_t len, size_t offset)
+{
+    while (offset < len)
+    {
+        uint8_t label_len = packet[offset];
+        if (label_len == 0)
+        {
+            return offset + 1;
+        }
+        // Compression pointers are not valid in a query's first question
+        if ((label_len & 0xC0) != 0)
+        {
+            return 0;
+        }
+        offset += label_len + 1;
+    }
+    return 0;
+}
+
+// Rewrites the query in place into a response, returns response length or 0 to drop
+static size_t build_response(uint8_t *packet, size_t len)
+{
+    if (len < DNS_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint16_t flags = read_u16(packet + 2);
+    uint16_t qdcount = read_u16(packet + 4);
+
+    // Ignore responses and anything that is not a standard query
+    if (flags & DNS_FLAG_QR)
+    {
+        return 0;
+    }
+
+    uint16_t reply_flags = DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA | (flags & DNS_FLAG_RD);
+    size_t question_end = 0;
+    uint16_t qtype = 0;
+    uint16_t qclass = 0;
+
+    if ((flags & DNS_OPCODE_MASK) != 0)
+    {
+        reply_flags |= DNS_RCODE_NOTIMP;
+        qdcount = 0;
+    }
+    else if (qdcount != 1 || (question_end = skip_qname(packet, len, DNS_HEADER_SIZE)) == 0 ||
+             question_end + 4 > len)
+    {
+        reply_flags |= DNS_RCODE_FORMERR;
+        qdcount = 0;
+    }
+    else
+    {
+        qtype = read_u16(packet + question_end);
+        qclass = read_u16(packet + question_end + 2);
+        question_end += 4;
+    }
+
+    bool answer = qdcount == 1 && qclass == DNS_CLASS_IN && (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY);
+
+    // Any other query type (e.g. AAAA) gets an empty NOERROR so clients fall back to A
+    write_u16(packet + 2, reply_flags);
+    write_u16(packet + 4, qdcount);
+    write_u16(packet + 6, answer ? 1 : 0);
+    write_u16(packet + 8, 0);
+    write_u16(packet + 10, 0);
+
+    size_t response_len = qdcount ? question_end : DNS_HEADER_SIZE;
+    if (!answer)
+    {
+        return response_len;
+    }
+
+    if (response_len + DNS_ANSWER_SIZE > DNS_SERVER_MAX_PACKET)
+    {
+        return 0;
+    }
+
+    uint8_t *ans = packet + response_len;
+    write_u16(ans, 0xC000 | DNS_HEADER_SIZE); // Name: pointer to the question
+    write_u16(ans + 2, DNS_TYPE_A);
+    write_u16(ans + 4, DNS_CLASS_IN);
+    write_u16(ans + 6, 0);
+    write_u16(ans + 8, DNS_SERVER_TTL_SECONDS);
+    write_u16(ans + 10, 4);
+    memcpy(ans + 12, &dns_answer_ip, 4); // Already in network byte order
+
+    return response_len + DNS_ANSWER_SIZE;
+}
+
+static void dns_server_task(void *pvParameters)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        goto exit;
+    }
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Wake periodically so dnsServer_stop() does not need to close the socket under us
+    struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in bind_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DNS_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY)};
+
+    if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0)
+    {
+        ESP_LOGE(TAG, "Failed to bind port %d: errno %d", DNS_SERVER_PORT, errno);
+        close(sock);
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Captive portal DNS listening on port %d", DNS_SERVER_PORT);
+
+    while (dns_running)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int received = recvfrom(sock, dns_packet, sizeof(dns_packet), 0,
+                                (struct sockaddr *)&client_addr, &addr_len);
+        if (received <= 0)
+        {
+            continue;
+        }
+
+        size_t response_len = build_response(dns_packet, (size_t)received);
+        if (response_len > 0)
+        {
+            sendto(sock, dns_packet, response_len, 0, (struct sockaddr *)&client_addr, addr_len);
+        }
+    }
+
+    close(sock);
+    ESP_LOGI(TAG, "Captive portal DNS stopped");
+
+exit:
+    dns_running = false;
+    dns_task_handle = NULL;
+    otaTask_exit();
+}
+
+esp_err_t dnsServer_start(uint32_t ap_ip_addr)
+{
+    if (dns_task_handle != NULL)
+    {
+        ESP_LOGW(TAG, "DNS server already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    dns_answer_ip = ap_ip_addr;
+    dns_running = true;
+
+    esp_err_t err = otaTask_create(
+        dns_server_task,
+        "ota_dns",
+        OTA_TASK_STACK_DNS,
+        NULL, // Parameters
+        OTA_TASK_PRIORITY_NET,
+        &dns_task_handle);
+
+    if (err != ESP_OK)
+    {
+        dns_running = false;
+        dns_task_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void dnsServer_stop(void)
+{
+    if (dns_task_handle == NULL)
+    {
+        return;
+    }
+
+    dns_running = false;
+
+    // The task notices within one receive timeout and clears its handle on exit
+    for (int i = 0; i < 20 && dns_task_handle != NULL; i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+bool dnsServer_isRunning(void)
+{
+    return dns_running;
+}
@@ -0,0 +1,267 @@
+#include "healthCheck.h"
+#include "otaTask.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include <string.h>
+
+static const char *TAG = "HEALTH_CHECK";
+
+typedef struct
+{
+    const char *name;
+    simple_ota_health_check_fn_t fn;
+    void *arg;
+    uint32_t timeout_ms;
+} health_check_t;
+
+typedef struct
+{
+    uint8_t index;
+    bool passed;
+} health_result_t;
+
+// Fixed table, checks are registered once at startup
+static health_check_t checks[CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS];
+static size_t check_count = 0;
+static QueueHandle_t result_queue = NULL;
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+static StaticQueue_t result_queue_buffer;
+static uint8_t result_queue_storage[CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS * sizeof(health_result_t)];
+#endif
+static volatile bool validation_pending = false;
+static int64_t boot_to_valid_ms = -1;
+
+esp_err_t healthCheck_register(const char *name, simple_ota_health_check_fn_t fn, void *arg, uint32_t timeout_ms)
+{
+    if (!name || !fn || timeout_ms == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (validation_pending)
+    {
+        ESP_LOGW(TAG, "Health checks already running, '%s' not registered", name);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (check_count >= CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS)
+    {
+        ESP_LOGE(TAG, "No room for health check '%s'", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    checks[check_count].name = name;
+    checks[check_count].fn = fn;
+    checks[check_count].arg = arg;
+    checks[check_count].timeout_ms = timeout_ms;
+    check_count++;
+    return ESP_OK;
+}
+
+static void record_boot_to_valid(void)
+{
+    boot_to_valid_ms = esp_timer_get_time() / 1000;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(HEALTH_CHECK_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not open NVS to record boot-to-valid time, error=%d", err);
+        return;
+    }
+    nvs_set_u32(nvs, HEALTH_CHECK_NVS_KEY, (uint32_t)boot_to_valid_ms);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void mark_valid(void)
+{
+    esp_ota_mark_app_valid_cancel_rollback();
+    record_boot_to_valid();
+    validation_pending = false;
+    ESP_LOGI(TAG, "Firmware confirmed valid %lld ms after boot", (long long)boot_to_valid_ms);
+}
+
+static void roll_back(const health_check_t *check, const char *reason)
+{
+    ESP_LOGE(TAG, "Health check '%s' %s, rolling back to the previous firmware", check->name, reason);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+
+    // Only returns when there is no other image to go back to
+    ESP_LOGE(TAG, "Rollback failed, firmware left unconfirmed");
+    validation_pending = false;
+}
+
+static void health_check_task(void *pvParameters)
+{
+    uint8_t index = (uint8_t)(uintptr_t)pvParameters;
+    health_result_t result = {
+        .index = index,
+        .passed = checks[index].fn(checks[index].arg)};
+
+    // The queue holds one result per check, this never blocks
+    xQueueSend(result_queue, &result, 0);
+    otaTask_exit();
+}
+
+static void health_supervisor_task(void *pvParameters)
+{
+    const int64_t start_us = esp_timer_get_time();
+    bool finished[CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS] = {0};
+    size_t remaining = check_count;
+
+    for (size_t i = 0; i < check_count; i++)
+    {
+        esp_err_t err = otaTask_create(
+            health_check_task,
+            "ota_health_chk",
+            OTA_TASK_STACK_HEALTH_CHECK,
+            (void *)(uintptr_t)i,
+            OTA_TASK_PRIORITY_BACKGROUND,
+            NULL);
+        if (err != ESP_OK)
+        {
+            roll_back(&checks[i], "could not be started");
+            goto exit;
+        }
+    }
+
+    while (remaining > 0)
+    {
+        // Sleep until the next result arrives or the nearest deadline passes
+        int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+        int64_t wait_ms = INT64_MAX;
+        for (size_t i = 0; i < check_count; i++)
+        {
+            if (finished[i])
+            {
+                continue;
+            }
+            int64_t left_ms = (int64_t)checks[i].timeout_ms - elapsed_ms;
+            if (left_ms <= 0)
+            {
+                roll_back(&checks[i], "timed out");
+                goto exit;
+            }
+            if (left_ms < wait_ms)
+            {
+                wait_ms = left_ms;
+            }
+        }
+
+        health_result_t result;
+        if (xQueueReceive(result_queue, &result, pdMS_TO_TICKS(wait_ms) + 1) != pdTRUE)
+        {
+            continue;
+        }
+        if (!result.passed)
+        {
+            roll_back(&checks[result.index], "failed");
+            goto exit;
+        }
+
+        ESP_LOGI(TAG, "Health check '%s' passed after %lld ms", checks[result.index].name,
+                 (long long)((esp_timer_get_time() - start_us) / 1000));
+        finished[result.index] = true;
+        remaining--;
+    }
+
+    mark_valid();
+
+exit:
+    otaTask_exit();
+}
+
+void healthCheck_validateBoot(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t ota_state;
+    ESP_LOGI(TAG, "Starting OTA validation check...");
+    if (esp_ota_get_state_partition(running, &ota_state) != ESP_OK)
+    {
+        ESP_LOGI(TAG, "Normal execution ...");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Running partition: %s, address: 0x%08lX", running->label, (unsigned long)running->address);
+    if (ota_state != ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        ESP_LOGI(TAG, "OTA state is %d, no action required.", ota_state);
+        return;
+    }
+
+    if (check_count == 0)
+    {
+        ESP_LOGI(TAG, "No health checks registered, confirming firmware");
+        mark_valid();
+        return;
+    }
+
+    // Created once and kept, a check that outlives its deadline may still post to it
+    if (!result_queue)
+    {
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+        result_queue = xQueueCreateStatic(CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS, sizeof(health_result_t),
+                                          result_queue_storage, &result_queue_buffer);
+#else
+        result_queue = xQueueCreate(CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS, sizeof(health_result_t));
+#endif
+    }
+
+    validation_pending = true;
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (result_queue)
+    {
+        err = otaTask_create(
+            health_supervisor_task,
+            "ota_health",
+            OTA_TASK_STACK_HEALTH,
+            NULL, // Parameters
+            OTA_TASK_PRIORITY_NET,
+            NULL);
+    }
+
+    if (err != ESP_OK)
+    {
+        // Left pending, the bootloader rolls back if the device resets before confirmation
+        ESP_LOGE(TAG, "Failed to start health checks, firmware left unconfirmed");
+        validation_pending = false;
+        return;
+    }
+
+    ESP_LOGI(TAG, "OTA state pending verify - running %u health checks...", (unsigned)check_count);
+}
+
+bool healthCheck_isPending(void)
+{
+    return validation_pending;
+}
+
+int64_t healthCheck_getBootToValidMs(void)
+{
+    if (validation_pending)
+    {
+        return -1;
+    }
+    if (boot_to_valid_ms >= 0)
+    {
+        return boot_to_valid_ms;
+    }
+
+    // Not confirmed this boot, report the last update's figure
+    nvs_handle_t nvs;
+    uint32_t stored_ms;
+    if (nvs_open(HEALTH_CHECK_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return -1;
+    }
+    if (nvs_get_u32(nvs, HEALTH_CHECK_NVS_KEY, &stored_ms) == ESP_OK)
+    {
+        boot_to_valid_ms = stored_ms;
+    }
+    nvs_close(nvs);
+    return boot_to_valid_ms;
+}
@@ -18,24 +18,28 @@
 #define OTA_FIRMWARE_UPLOADED 3
 #define OTA_FIRMWARE_DONE 4
 
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
-extern const uint8_t main_css_start[] asm("_binary_main_css_start");
-extern const uint8_t main_css_end[] asm("_binary_main_css_end");
-extern const uint8_t main_js_start[] asm("_binary_main_js_start");
-extern const uint8_t main_js_end[] asm("_binary_main_js_end");
-
 void apUpdate_startAP(char *networkName);
+// AP, mDNS, web server and the AP timeout; returns once they are up
+void apUpdate_start(void);
+// Task entry for apUpdate_start(), exits when it returns
 void apUpdate_task(void *pvParameters);
 void apUpdate_wifiEventHandler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 void apUpdate_startWebserver(void);
 void apUpdate_stop(void);
 void apUpdate_initMdns(const char* hostname);
 
+// Station mode for pulling firmware from another device or server. If the application is
+// already connected, that link is used as it is and stopSta() leaves it up
+esp_err_t apUpdate_startSta(const char *ssid, const char *password, uint32_t timeout_ms);
+void apUpdate_stopSta(void);
+
 // Timeout control functions
 void apUpdate_cancelTimeout(void);
 bool apUpdate_isTimeoutActive(void);
 
+// Captive portal metrics
+int64_t apUpdate_getPortalLatencyMs(void);
+
 #endif // APUPDATE_H 
 
 
@@ -0,0 +1,37 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Layout written by tools/pack_assets.py, keep the two in step
+#define ASSET_BUNDLE_MAGIC "OTAB"
+#define ASSET_BUNDLE_VERSION 1
+
+#define ASSET_FLAG_USED 0x01
+#define ASSET_FLAG_GZIP 0x02     // Body is gzip, sent with Content-Encoding
+#define ASSET_FLAG_TEMPLATE 0x04 // Body holds {{PLACEHOLDERS}} substituted while sending
+
+typedef struct
+{
+    const char *path; // Points into flash, not NUL terminated
+    size_t path_len;
+    const uint8_t *data; // Points into flash
+    size_t length;
+    uint32_t etag;
+    const char *mime_type;
+    uint8_t flags;
+} asset_t;
+
+// Check the embedded bundle, must succeed before assetBundle_find() returns anything
+esp_err_t assetBundle_init(void);
+
+// Resolve a request path (query string already stripped). Bounded probes, so the cost does
+// not grow with the number of assets. Returns ESP_ERR_NOT_FOUND for unknown paths.
+esp_err_t assetBundle_find(const char *path, size_t path_len, asset_t *asset);
+
+// Mean cost of one lookup in nanoseconds over every route, for measuring router overhead
+uint32_t assetBundle_benchmarkLookupNs(uint32_t iterations);
+
+#endif // ASSET_BUNDLE_H
@@ -0,0 +1,17 @@
+#ifndef DNS_SERVER_H
+#define DNS_SERVER_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DNS_SERVER_PORT 53
+#define DNS_SERVER_MAX_PACKET 512
+#define DNS_SERVER_TTL_SECONDS 60
+
+// Captive portal DNS responder, answers every A query with the AP address
+esp_err_t dnsServer_start(uint32_t ap_ip_addr);
+void dnsServer_stop(void);
+bool dnsServer_isRunning(void);
+
+#endif // DNS_SERVER_H
@@ -0,0 +1,25 @@
+#ifndef HEALTH_CHECK_H
+#define HEALTH_CHECK_H
+
+#include "esp_err.h"
+#include "simpleOTA.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HEALTH_CHECK_NVS_NAMESPACE "simple_ota"
+#define HEALTH_CHECK_NVS_KEY "boot_valid_ms"
+
+// Register an application health check, must happen before healthCheck_validateBoot()
+esp_err_t healthCheck_register(const char *name, simple_ota_health_check_fn_t fn, void *arg, uint32_t timeout_ms);
+
+// If the running image is pending verification, run every check in its own task and
+// mark the image valid or roll back once they finish. Returns without waiting.
+void healthCheck_validateBoot(void);
+
+// True while a new image is waiting for its health checks
+bool healthCheck_isPending(void);
+
+// Milliseconds from boot until the last new image was confirmed, -1 if unknown or pending
+int64_t healthCheck_getBootToValidMs(void);
+
+#endif // HEALTH_CHECK_H
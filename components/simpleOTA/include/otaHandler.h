@@ -2,20 +2,98 @@
 #define OTA_HANDLER_H
 
 #include "esp_ota_ops.h"
+#include "esp_app_format.h"
 #include "esp_err.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "simpleOTA.h"
+#include <sys/param.h>
 #include <stdio.h>
 #include <stdbool.h>
 
-// OTA validation and rollback
-void otaHandler_validateUpdate(void);
+// Image header, first segment header and app descriptor: enough to identify an image
+#define OTA_HANDLER_HEADER_BYTES (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+
+// Metadata a client may announce before sending the image, all fields optional
+typedef struct
+{
+    bool has_sha256;
+    uint8_t sha256[32];
+    bool has_chip_id;
+    uint16_t chip_id;
+    size_t expected_size; // 0 if unknown
+} otaHandler_preflight_t;
 
 // Firmware validation
-bool otaHandler_validateFirmware(const uint8_t *data, size_t len);
+bool otaHandler_validateFirmware(const uint8_t *data, size_t len, const otaHandler_preflight_t *preflight);
+
+// Streaming OTA session shared by all transports. Any failed write aborts the session.
+// Finish returns ESP_ERR_INVALID_CRC / ESP_ERR_INVALID_SIZE if the preflight digest or size do not match.
+esp_err_t otaHandler_sessionBegin(const otaHandler_preflight_t *preflight);
+esp_err_t otaHandler_sessionWrite(const uint8_t *data, size_t len);
+esp_err_t otaHandler_sessionFinish(void);
+void otaHandler_sessionAbort(void);
+size_t otaHandler_sessionWritten(void);
+
+// Resumable uploads (CONFIG_SIMPLE_OTA_UPLOAD_RESUME). Suspend keeps a session whose client went
+// away open for CONFIG_SIMPLE_OTA_RESUME_TIMEOUT_S, or aborts it if it cannot be identified (no
+// digest announced). Resume continues it at offset for a client announcing the same digest and
+// size; ESP_ERR_NOT_FOUND if nothing is suspended, ESP_ERR_INVALID_ARG if the offset or image differ.
+void otaHandler_sessionSuspend(void);
+esp_err_t otaHandler_sessionResume(const otaHandler_preflight_t *preflight, size_t offset);
+// Offset a suspended session can be resumed at and the digest it expects, 0 if none
+size_t otaHandler_sessionResumeOffset(uint8_t sha256[32]);
+
+// Longest single esp_ota_write (flash cache disabled) of the current or last session
+int64_t otaHandler_getWorstFlashStallUs(void);
+
+// Reboot delay after a successful upload, long enough for the HTTP response to reach the client
+#define OTA_HANDLER_REBOOT_FLUSH_MS 1000
+// How often a deferred reboot asks the application again
+#define OTA_HANDLER_REBOOT_RETRY_MS 500
+
+// Returns true when the application can tolerate a reboot right now
+typedef bool (*otaHandler_rebootCheck_t)(void);
+
+// Set the last completed session's partition as boot partition
+esp_err_t otaHandler_activateUpdate(void);
+
+// A completed session whose partition is not yet the boot partition
+bool otaHandler_hasStagedUpdate(void);
+
+// Activate the staged image and reboot after delay_ms (and once the reboot check agrees)
+esp_err_t otaHandler_activateStaged(uint32_t delay_ms);
+esp_err_t otaHandler_scheduleReboot(uint32_t delay_ms);
+
+// When auto reboot is off, uploads are only staged (default CONFIG_SIMPLE_OTA_AUTO_REBOOT)
+void otaHandler_setAutoReboot(bool enable);
+bool otaHandler_isAutoReboot(void);
+void otaHandler_setRebootCheck(otaHandler_rebootCheck_t check);
+
+// True if the image starting at data has the same app ELF SHA-256 as the running app
+bool otaHandler_isRunningImage(const uint8_t *data, size_t len);
+
+// App partitions with descriptor, rollback state and verification result
+esp_err_t otaHandler_listSlots(simple_ota_slot_info_t *slots, size_t max_slots, size_t *count);
+
+// Verify the image in partition, make it the boot partition and reboot into it
+esp_err_t otaHandler_switchToSlot(const esp_partition_t *partition, uint32_t delay_ms);
 
 // OTA upload handler for HTTP server
 esp_err_t otaHandler_updatePostHandler(httpd_req_t *req);
 
+// Activate a staged upload, optional ?delay_ms= before the reboot
+esp_err_t otaHandler_activatePostHandler(httpd_req_t *req);
+
+// Firmware download handler, streams an app slot back out (supports Range)
+esp_err_t otaHandler_firmwareGetHandler(httpd_req_t *req);
+
+// Slot list as JSON, and switching to a slot by ?slot=<label>|next&delay_ms=
+esp_err_t otaHandler_slotsGetHandler(httpd_req_t *req);
+esp_err_t otaHandler_slotSwitchPostHandler(httpd_req_t *req);
+
+// Device/app information as JSON for the web UI and tooling
+esp_err_t otaHandler_infoGetHandler(httpd_req_t *req);
+
 #endif // OTA_HANDLER_H
\ No newline at end of file
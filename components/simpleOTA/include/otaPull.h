@@ -0,0 +1,23 @@
+#ifndef OTA_PULL_H
+#define OTA_PULL_H
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "sdkconfig.h"
+#include <stddef.h>
+
+// Returned when the remote image is the one already running
+#define OTA_PULL_ERR_UP_TO_DATE (ESP_ERR_OTA_BASE + 0x40)
+
+typedef void (*otaPull_progress_cb_t)(size_t received, size_t total);
+
+// Both return ESP_ERR_NOT_SUPPORTED unless CONFIG_SIMPLE_OTA_PULL is set
+
+// Stream an image from url through the OTA session (does not activate it)
+// Download is pipelined with flash writes and resumes dropped connections with Range requests
+esp_err_t otaPull_fromUrl(const char *url, otaPull_progress_cb_t progress_cb);
+
+// Fetch a {"version": "...", "url": "..."} manifest and pull the image unless version matches the running app
+esp_err_t otaPull_fromManifest(const char *manifest_url, otaPull_progress_cb_t progress_cb);
+
+#endif // OTA_PULL_H
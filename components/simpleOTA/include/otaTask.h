@@ -0,0 +1,80 @@
+#ifndef OTA_TASK_H
+#define OTA_TASK_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// Core every OTA-owned task (httpd, pull, DNS, timers) runs on
+#if CONFIG_SIMPLE_OTA_PIN_TASKS
+#define OTA_TASK_CORE CONFIG_SIMPLE_OTA_TASK_CORE
+#else
+#define OTA_TASK_CORE tskNO_AFFINITY
+#endif
+
+// Priority classes: network receive, flash writes, housekeeping
+#define OTA_TASK_PRIORITY_NET CONFIG_SIMPLE_OTA_NET_PRIORITY
+#define OTA_TASK_PRIORITY_FLASH CONFIG_SIMPLE_OTA_FLASH_PRIORITY
+#define OTA_TASK_PRIORITY_BACKGROUND CONFIG_SIMPLE_OTA_BACKGROUND_PRIORITY
+
+// Stack sizes of every OTA task. Each task logs its high-water mark on exit,
+// use those figures (plus headroom) when changing these.
+#define OTA_TASK_STACK_MAIN 8192
+#define OTA_TASK_STACK_AP_TIMEOUT 4096
+#define OTA_TASK_STACK_DNS 3072
+#define OTA_TASK_STACK_PULL_WRITER 4096
+#define OTA_TASK_STACK_HEALTH 3072
+#define OTA_TASK_STACK_HEALTH_CHECK CONFIG_SIMPLE_OTA_HEALTH_CHECK_STACK
+#define OTA_TASK_STACK_UART 4096
+#define OTA_TASK_STACK_UDP 4096
+
+// Optional transports only count towards the budget when enabled
+#if CONFIG_SIMPLE_OTA_UART
+#define OTA_TASK_UART_TASKS 1
+#else
+#define OTA_TASK_UART_TASKS 0
+#endif
+#if CONFIG_SIMPLE_OTA_UDP
+#define OTA_TASK_UDP_TASKS 1
+#else
+#define OTA_TASK_UDP_TASKS 0
+#endif
+#if CONFIG_SIMPLE_OTA_PULL
+#define OTA_TASK_PULL_TASKS 1
+#else
+#define OTA_TASK_PULL_TASKS 0
+#endif
+
+// Worst case with every OTA task alive at once
+#define OTA_TASK_MAX_TASKS (4 + OTA_TASK_PULL_TASKS + OTA_TASK_UART_TASKS + OTA_TASK_UDP_TASKS + CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS)
+#define OTA_TASK_STACK_BUDGET (OTA_TASK_STACK_MAIN + OTA_TASK_STACK_AP_TIMEOUT + OTA_TASK_STACK_DNS + \
+                               OTA_TASK_PULL_TASKS * OTA_TASK_STACK_PULL_WRITER +                    \
+                               OTA_TASK_STACK_HEALTH +                                               \
+                               OTA_TASK_UART_TASKS * OTA_TASK_STACK_UART +                           \
+                               OTA_TASK_UDP_TASKS * OTA_TASK_STACK_UDP +                             \
+                               CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS * OTA_TASK_STACK_HEALTH_CHECK)
+
+// Create an OTA task with the configured core affinity. With
+// CONFIG_SIMPLE_OTA_STATIC_ALLOCATION the stack and TCB come from a fixed
+// arena of OTA_TASK_STACK_BUDGET bytes and are reused by the next task of the same name.
+esp_err_t otaTask_create(TaskFunction_t task, const char *name, uint32_t stack_size,
+                         void *param, UBaseType_t priority, TaskHandle_t *handle);
+
+// End the calling OTA task, use instead of vTaskDelete(NULL)
+void otaTask_exit(void);
+
+// End another OTA task, use instead of vTaskDelete(handle)
+void otaTask_delete(TaskHandle_t handle);
+
+// Arena use so far and the smallest stack headroom any exiting task had left
+typedef struct
+{
+    size_t arena_size;
+    size_t arena_used;
+    size_t min_stack_headroom;
+} otaTask_stats_t;
+
+void otaTask_getStats(otaTask_stats_t *stats);
+
+#endif // OTA_TASK_H
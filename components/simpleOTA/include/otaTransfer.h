@@ -0,0 +1,33 @@
+#ifndef OTA_TRANSFER_H
+#define OTA_TRANSFER_H
+
+#include "otaWindow.h"
+#include "simpleOTA.h"
+#include "sdkconfig.h"
+
+// Built only when a windowed transport is enabled
+#define OTA_TRANSFER_ENABLED (CONFIG_SIMPLE_OTA_UART || CONFIG_SIMPLE_OTA_UDP)
+
+// A started transfer that hears nothing for this long is abandoned
+#define OTA_TRANSFER_IDLE_TIMEOUT_MS 10000
+
+// Largest frame a windowed transport has to buffer
+#define OTA_TRANSFER_MAX_FRAME (CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES + OTA_FRAME_OVERHEAD)
+
+// Windowed transfer session shared by the UART and UDP transports: frames from the host drive
+// the common OTA session, replies go back over whichever transport the frame came in on.
+// There is one transfer at a time; a new START abandons the previous one.
+
+// Events (progress, result) are reported through cb, which may be NULL
+void otaTransfer_setEventCallback(simple_ota_event_cb_t cb);
+
+// Handle one host frame. Writes the reply (if any) to reply and returns its length.
+size_t otaTransfer_handleFrame(const otaFrame_t *frame, uint8_t *reply, size_t reply_cap);
+
+// Abandon a transfer that has gone quiet, call periodically from the transport task
+void otaTransfer_poll(void);
+
+// Abandon any transfer in progress
+void otaTransfer_reset(void);
+
+#endif // OTA_TRANSFER_H
@@ -0,0 +1,15 @@
+#ifndef OTA_UART_H
+#define OTA_UART_H
+
+#include "esp_err.h"
+#include "simpleOTA.h"
+#include <stdbool.h>
+
+// Accept firmware over CONFIG_SIMPLE_OTA_UART_PORT with the windowed protocol in otaWindow.h.
+// Events from the transfer are passed to cb. Returns ESP_ERR_NOT_SUPPORTED when the serial
+// transport is disabled in menuconfig.
+esp_err_t otaUart_start(simple_ota_event_cb_t cb);
+void otaUart_stop(void);
+bool otaUart_isRunning(void);
+
+#endif // OTA_UART_H
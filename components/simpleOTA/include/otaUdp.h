@@ -0,0 +1,17 @@
+#ifndef OTA_UDP_H
+#define OTA_UDP_H
+
+#include "esp_err.h"
+#include "simpleOTA.h"
+#include <stdbool.h>
+
+#define OTA_UDP_PORT CONFIG_SIMPLE_OTA_UDP_PORT
+
+// Accept firmware as UDP datagrams on OTA_UDP_PORT, one otaWindow.h frame per datagram.
+// Runs beside the web server in AP mode; events from the transfer are passed to cb.
+// Returns ESP_ERR_NOT_SUPPORTED when the UDP transport is disabled in menuconfig.
+esp_err_t otaUdp_start(simple_ota_event_cb_t cb);
+void otaUdp_stop(void);
+bool otaUdp_isRunning(void);
+
+#endif // OTA_UDP_H
@@ -0,0 +1,104 @@
+#ifndef OTA_WINDOW_H
+#define OTA_WINDOW_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Framing and sliding-window receiver shared by the UART and UDP transports.
+// tools/ota_uart_send.py is the reference sender, keep the two in step.
+//
+// Frame, little endian:
+//   sync 0xA5 0x5A | type u8 | flags u8 | seq u32 | length u16 | payload | crc32 u32
+// The CRC (IEEE 802.3, as zlib.crc32) covers type through payload.
+
+#define OTA_FRAME_SYNC0 0xA5
+#define OTA_FRAME_SYNC1 0x5A
+#define OTA_FRAME_HEADER_BYTES 10
+#define OTA_FRAME_OVERHEAD (OTA_FRAME_HEADER_BYTES + 4)
+#define OTA_FRAME_MAX_PAYLOAD 4096
+
+typedef enum
+{
+    OTA_FRAME_START = 1,  // Host: u32 image size, u8 flags, u8[32] SHA-256
+    OTA_FRAME_READY = 2,  // Device: u16 window slots, u16 chunk bytes
+    OTA_FRAME_DATA = 3,   // Host: seq is the chunk index
+    OTA_FRAME_ACK = 4,    // Device: seq is the next chunk needed, u32 bitmap, bit i = chunk seq + 1 + i held
+    OTA_FRAME_END = 5,    // Host: seq is the chunk count
+    OTA_FRAME_RESULT = 6, // Device: i32 esp_err_t, u8 otaWindow_outcome_t
+    OTA_FRAME_ABORT = 7,  // Either side gives up
+} otaFrame_type_t;
+
+// START flags
+#define OTA_START_FLAG_SHA256 0x01
+#define OTA_START_FLAG_FORCE 0x02 // Install even if the image is already running
+#define OTA_START_PAYLOAD_BYTES 38
+
+typedef enum
+{
+    OTA_OUTCOME_FAILED = 0,
+    OTA_OUTCOME_STAGED = 1,
+    OTA_OUTCOME_ACTIVATED = 2,
+} otaWindow_outcome_t;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t flags;
+    uint32_t seq;
+    uint16_t length;
+    const uint8_t *payload;
+} otaFrame_t;
+
+// Encode a frame into out, returns the encoded size or 0 if it does not fit
+size_t otaFrame_encode(uint8_t *out, size_t cap, uint8_t type, uint32_t seq, const uint8_t *payload, uint16_t length);
+
+// Decode one complete frame (a datagram), false if it is truncated or fails its CRC
+bool otaFrame_decode(const uint8_t *data, size_t len, otaFrame_t *frame);
+
+// Reassembles frames from a byte stream, resynchronising on the sync bytes after corruption
+typedef struct
+{
+    uint8_t *buffer;
+    size_t capacity;
+    size_t fill;
+    uint32_t crc_errors;
+} otaFrame_parser_t;
+
+void otaFrame_parserInit(otaFrame_parser_t *parser, uint8_t *buffer, size_t capacity);
+
+// Consume bytes from data until a frame completes. Returns the bytes consumed; *frame is
+// valid (and points into the parser buffer) until the next call when *complete is set.
+size_t otaFrame_parse(otaFrame_parser_t *parser, const uint8_t *data, size_t len, otaFrame_t *frame, bool *complete);
+
+// Chunks held past the one the sink needs are reported as a 32-bit SACK bitmap
+#define OTA_WINDOW_MAX_SLOTS 32
+
+// Chunks are handed to the sink strictly in order, whatever order they arrive in
+typedef esp_err_t (*otaWindow_sink_t)(uint32_t index, const uint8_t *data, size_t len, void *ctx);
+
+typedef struct
+{
+    uint8_t *buffer; // slots * chunk_bytes
+    uint16_t lengths[OTA_WINDOW_MAX_SLOTS];
+    uint16_t slots;
+    uint16_t chunk_bytes;
+    uint32_t base; // Next chunk the sink needs
+    uint32_t held; // Bit i set: chunk base + i is buffered
+    otaWindow_sink_t sink;
+    void *ctx;
+    uint32_t duplicates;
+} otaWindow_t;
+
+void otaWindow_init(otaWindow_t *window, uint8_t *buffer, uint16_t slots, uint16_t chunk_bytes,
+                    otaWindow_sink_t sink, void *ctx);
+
+// Accept chunk seq. Duplicates and chunks beyond the window are dropped (the ACK tells the
+// sender where it stands). Returns the sink's error if delivering fails.
+esp_err_t otaWindow_receive(otaWindow_t *window, uint32_t seq, const uint8_t *data, size_t len);
+
+// Encode the ACK frame for the current state, returns its size
+size_t otaWindow_encodeAck(const otaWindow_t *window, uint8_t *out, size_t cap);
+
+#endif // OTA_WINDOW_H
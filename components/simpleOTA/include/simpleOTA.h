@@ -2,12 +2,25 @@
 #define SIMPLE_OTA_H
 
 #include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "sdkconfig.h"
 #include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief How the device obtains new firmware
+ */
+typedef enum {
+    SIMPLE_OTA_MODE_AP_PUSH,        ///< Start an access point and wait for an upload
+    SIMPLE_OTA_MODE_MIRROR_PULL,    ///< Pull from a neighbouring device's /firmware, then serve as AP.
+                                    ///< Without auto_reboot the staged image is what /firmware serves
+    SIMPLE_OTA_MODE_STA_PULL,       ///< Join site Wi-Fi and pull the image named by a manifest
+    SIMPLE_OTA_MODE_SERIAL          ///< No Wi-Fi, receive over UART (needs CONFIG_SIMPLE_OTA_UART)
+} simple_ota_mode_t;
+
 /**
  * @brief Simple OTA Configuration Structure
  */
@@ -16,7 +29,12 @@ typedef struct {
     const char* ap_password;    ///< Access Point password (default: "simpleOTA")
     const char* hostname;       ///< mDNS hostname (default: "simpleota")
     uint16_t timeout_minutes;   ///< AP timeout in minutes (default: 0, 0 = no timeout)
-    bool auto_reboot;           ///< Auto reboot after successful OTA (default: true)
+    bool auto_reboot;           ///< Auto reboot after successful OTA, otherwise stage it (default: true)
+    simple_ota_mode_t mode;     ///< Update mode (default: SIMPLE_OTA_MODE_AP_PUSH)
+    const char* sta_ssid;       ///< Network to join in pull modes (default: "Simple OTA")
+    const char* sta_password;   ///< Password for sta_ssid (default: "simpleota")
+    const char* pull_url;       ///< Image URL in mirror mode (default: "http://10.0.0.1/firmware")
+    const char* manifest_url;   ///< Manifest URL in STA pull mode, see README for the format
 } simple_ota_config_t;
 
 /**
@@ -29,18 +47,59 @@ typedef enum {
     SIMPLE_OTA_UPLOADING,
     SIMPLE_OTA_SUCCESS,
     SIMPLE_OTA_FAILED,
-    SIMPLE_OTA_TIMEOUT
+    SIMPLE_OTA_TIMEOUT,
+    SIMPLE_OTA_DOWNLOADING,
+    SIMPLE_OTA_STAGED,
+    SIMPLE_OTA_SERIAL_STARTED
 } simple_ota_status_t;
 
+/**
+ * @brief Application health check
+ * 
+ * Runs in its own task after an update, in parallel with the rest of startup.
+ * It may block (e.g. wait for a sensor or the cloud connection) up to the
+ * timeout given at registration.
+ * 
+ * @param arg Argument given at registration
+ * @return true if the new firmware is healthy, false to roll back
+ */
+typedef bool (*simple_ota_health_check_fn_t)(void* arg);
+
+/**
+ * @brief One app partition as reported by simpleOTA_listSlots()
+ */
+typedef struct {
+    char label[17];             ///< Partition label, e.g. "ota_0"
+    uint32_t address;           ///< Flash offset
+    uint32_t size;              ///< Partition size in bytes
+    bool running;               ///< Currently executing from this slot
+    bool boot;                  ///< Selected for the next boot
+    bool has_app;               ///< An app descriptor was found, app is valid
+    esp_app_desc_t app;         ///< Version, project, IDF version, ELF SHA-256 of the image
+    bool has_state;             ///< Slot has an OTA image state (false for factory)
+    esp_ota_img_states_t state; ///< Rollback state of the image
+    bool valid;                 ///< Image passes the on-device hash/signature check
+} simple_ota_slot_info_t;
+
 /**
  * @brief OTA Event callback function type
  * 
  * @param status Current OTA status
- * @param progress Upload progress (0-100) when status is SIMPLE_OTA_UPLOADING
+ * @param progress Progress (0-100) when status is SIMPLE_OTA_UPLOADING or SIMPLE_OTA_DOWNLOADING
  * @param message Optional status message
  */
 typedef void (*simple_ota_event_cb_t)(simple_ota_status_t status, int progress, const char* message);
 
+/**
+ * @brief Reboot permission callback type
+ * 
+ * Called from the esp_timer task when an activated update is due to reboot.
+ * Keep it short and non-blocking.
+ * 
+ * @return true if the application can be restarted now, false to be asked again later
+ */
+typedef bool (*simple_ota_reboot_check_cb_t)(void);
+
 /**
  * @brief Default configuration initialiser (uses Kconfig values)
  * 
@@ -49,12 +108,27 @@ typedef void (*simple_ota_event_cb_t)(simple_ota_status_t status, int progress,
  * 
  * @return Default simple_ota_config_t structure from Kconfig
  */
+#if CONFIG_SIMPLE_OTA_MODE_MIRROR_PULL
+#define SIMPLE_OTA_DEFAULT_MODE SIMPLE_OTA_MODE_MIRROR_PULL
+#elif CONFIG_SIMPLE_OTA_MODE_STA_PULL
+#define SIMPLE_OTA_DEFAULT_MODE SIMPLE_OTA_MODE_STA_PULL
+#elif CONFIG_SIMPLE_OTA_MODE_SERIAL
+#define SIMPLE_OTA_DEFAULT_MODE SIMPLE_OTA_MODE_SERIAL
+#else
+#define SIMPLE_OTA_DEFAULT_MODE SIMPLE_OTA_MODE_AP_PUSH
+#endif
+
 #define SIMPLE_OTA_DEFAULT_CONFIG() { \
     .ap_ssid = CONFIG_SIMPLE_OTA_AP_SSID, \
     .ap_password = CONFIG_SIMPLE_OTA_AP_PASSWORD, \
     .hostname = CONFIG_SIMPLE_OTA_HOSTNAME, \
     .timeout_minutes = CONFIG_SIMPLE_OTA_TIMEOUT_MINUTES, \
-    .auto_reboot = CONFIG_SIMPLE_OTA_AUTO_REBOOT \
+    .auto_reboot = CONFIG_SIMPLE_OTA_AUTO_REBOOT, \
+    .mode = SIMPLE_OTA_DEFAULT_MODE, \
+    .sta_ssid = CONFIG_SIMPLE_OTA_STA_SSID, \
+    .sta_password = CONFIG_SIMPLE_OTA_STA_PASSWORD, \
+    .pull_url = CONFIG_SIMPLE_OTA_PULL_URL, \
+    .manifest_url = CONFIG_SIMPLE_OTA_MANIFEST_URL \
 }
 
 /**
@@ -115,16 +189,154 @@ bool simpleOTA_isRunning(void);
  */
 const char* simpleOTA_getApIp(void);
 
+/**
+ * @brief Get captive portal discovery time
+ * 
+ * Time between the last client associating with the AP and it first loading
+ * the upload page, e.g. through the OS captive portal popup.
+ * 
+ * @return Latency in milliseconds, or -1 if no client has loaded the page yet
+ */
+int64_t simpleOTA_getPortalLatencyMs(void);
+
+/**
+ * @brief Get the worst flash stall of the current or last update
+ * 
+ * Longest single flash operation, during which the cache is disabled and
+ * code outside IRAM cannot run. Bound it with CONFIG_SIMPLE_OTA_FLASH_PACING.
+ * 
+ * @return Stall in microseconds, 0 if nothing has been written yet
+ */
+int64_t simpleOTA_getWorstFlashStallUs(void);
+
+/**
+ * @brief Check for a staged update
+ * 
+ * With auto_reboot disabled, a successful upload or pull is written and
+ * verified but the device keeps booting the current firmware.
+ * 
+ * @return true if a verified image is waiting for activation
+ */
+bool simpleOTA_hasStagedUpdate(void);
+
+/**
+ * @brief Activate the staged update and schedule a reboot into it
+ * 
+ * Sets the staged image as boot partition and reboots after delay_ms. If a
+ * reboot check is registered, the reboot is postponed until it returns true.
+ * 
+ * @param delay_ms Delay before the reboot (and the first reboot check)
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if nothing is staged
+ */
+esp_err_t simpleOTA_activateStaged(uint32_t delay_ms);
+
+/**
+ * @brief Set the callback that decides when rebooting is safe
+ * 
+ * Applies to every reboot into new firmware, automatic or staged.
+ * 
+ * @param callback Reboot permission callback, NULL to reboot unconditionally
+ * @return ESP_OK on success
+ */
+esp_err_t simpleOTA_setRebootCheck(simple_ota_reboot_check_cb_t callback);
+
+/**
+ * @brief List every app partition
+ * 
+ * Each image is verified (hash and, with secure boot, signature), so this
+ * takes a few hundred milliseconds per populated slot.
+ * 
+ * @param slots Array to fill, in partition table order
+ * @param max_slots Capacity of slots
+ * @param count Set to the number of app partitions, which may exceed max_slots
+ * @return ESP_OK on success
+ */
+esp_err_t simpleOTA_listSlots(simple_ota_slot_info_t* slots, size_t max_slots, size_t* count);
+
+/**
+ * @brief Boot a firmware that is already in flash
+ * 
+ * Verifies the image in the slot, sets it as boot partition and reboots
+ * after delay_ms (respecting the reboot check). Rolling back to the previous
+ * firmware becomes a reboot instead of another upload. Selecting the running
+ * slot cancels a pending activation without rebooting.
+ * 
+ * @param label App partition label, or NULL for the other OTA slot (the previous firmware)
+ * @param delay_ms Delay before the reboot
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND for an unknown slot,
+ *         ESP_ERR_IMAGE_INVALID if the image fails verification,
+ *         ESP_ERR_INVALID_STATE if the image was rolled back or an update is in progress
+ */
+esp_err_t simpleOTA_switchToSlot(const char* label, uint32_t delay_ms);
+
+/**
+ * @brief Memory reserved and used by OTA tasks
+ */
+typedef struct {
+    size_t static_budget;       ///< Stack arena reserved at build time (0 without CONFIG_SIMPLE_OTA_STATIC_ALLOCATION)
+    size_t static_used;         ///< Part of the arena handed out so far
+    size_t min_stack_headroom;  ///< Smallest stack margin left by an exiting OTA task, 0 if none has exited
+} simple_ota_memory_t;
+
+/**
+ * @brief Get the OTA memory budget
+ * 
+ * static_used never exceeds static_budget and stops growing once every OTA
+ * task has run once. A low min_stack_headroom means a stack size in
+ * otaTask.h needs raising.
+ * 
+ * @param memory Filled with the current figures
+ * @return ESP_OK on success
+ */
+esp_err_t simpleOTA_getMemoryBudget(simple_ota_memory_t* memory);
+
 /**
  * @brief Validate OTA update on boot (call this in app_main)
  * 
  * This should be called early in app_main() to confirm successful OTA updates
  * or rollback to previous firmware if the new firmware fails.
  * 
+ * After an update, the registered health checks are started and this returns
+ * straight away. The image is marked valid once every check passes, or rolled
+ * back as soon as one fails or misses its deadline. Without registered checks
+ * the image is confirmed immediately.
+ * 
  * @return ESP_OK if validation successful
  */
 esp_err_t simpleOTA_validateOnBoot(void);
 
+/**
+ * @brief Register a health check for new firmware
+ * 
+ * Call before simpleOTA_validateOnBoot(). Up to
+ * CONFIG_SIMPLE_OTA_MAX_HEALTH_CHECKS checks can be registered.
+ * 
+ * @param name Name used in logs, must stay valid
+ * @param check Check function
+ * @param arg Passed to check
+ * @param timeout_ms Deadline from the start of validation, a late check counts as failed
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the table is full,
+ *         ESP_ERR_INVALID_STATE if validation has already started
+ */
+esp_err_t simpleOTA_registerHealthCheck(const char* name, simple_ota_health_check_fn_t check, void* arg, uint32_t timeout_ms);
+
+/**
+ * @brief Check whether new firmware is still waiting for its health checks
+ * 
+ * @return true until the image is confirmed or rolled back
+ */
+bool simpleOTA_isValidationPending(void);
+
+/**
+ * @brief Get the time it took the last update to be confirmed
+ * 
+ * Milliseconds from boot until the image was marked valid, kept in NVS
+ * (namespace "simple_ota") so it survives later reboots.
+ * 
+ * @return Latency in milliseconds, or -1 if not recorded or validation is pending
+ */
+int64_t simpleOTA_getBootToValidMs(void);
+
 #ifdef __cplusplus
 }
 #endif
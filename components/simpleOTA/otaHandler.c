@@ -1,23 +1,33 @@
 #include "otaHandler.h"
+#include "healthCheck.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_http_server.h"
 #include "esp_ota_ops.h"
 #include "esp_partition.h"
+#include "esp_image_format.h"
+#include "esp_app_desc.h"
+#include "esp_chip_info.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
 #include <string.h>
+#include <stdlib.h>
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+#include "rom/miniz.h"
+#define OTA_UPLOAD_DEFLATE true
+#else
+#define OTA_UPLOAD_DEFLATE false
+#endif
 
 static const char *TAG = "OTA_HANDLER";
 
-static bool diagnostic(void) 
-{
-    bool diagnostic_is_ok = 1; // Needs to be customised for the specific use case
-    return diagnostic_is_ok;
-}
+#define FIRMWARE_MMAP_WINDOW (64 * 1024)
 
-bool otaHandler_validateFirmware(const uint8_t *data, size_t len)
+bool otaHandler_validateFirmware(const uint8_t *data, size_t len, const otaHandler_preflight_t *preflight)
 {
     if (len < 32)
         return false;
@@ -29,165 +39,340 @@ bool otaHandler_validateFirmware(const uint8_t *data, size_t len)
         return false;
     }
 
+    // Image header carries the chip it was built for
+    const esp_image_header_t *header = (const esp_image_header_t *)data;
+    if (header->chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID)
+    {
+        ESP_LOGE(TAG, "Firmware built for chip id %d, this device is %d", header->chip_id, CONFIG_IDF_FIRMWARE_CHIP_ID);
+        return false;
+    }
+
+    if (preflight && preflight->has_chip_id && preflight->chip_id != header->chip_id)
+    {
+        ESP_LOGE(TAG, "Announced chip id %d does not match image header", preflight->chip_id);
+        return false;
+    }
+
     ESP_LOGI(TAG, "Firmware header validation passed");
     return true;
 }
 
-void otaHandler_validateUpdate(void)
+// Single streaming OTA session shared by every transport (HTTP push, pull, ...)
+typedef struct
 {
-    const esp_partition_t *running = esp_ota_get_running_partition();
-    esp_ota_img_states_t ota_state;
-    ESP_LOGI(TAG, "Starting OTA validation check...");
-    if (esp_ota_get_state_partition(running, &ota_state) == ESP_OK)
-        {
-        ESP_LOGI(TAG, "Running partition: %s, address: 0x%08lX", running->label, (unsigned long)running->address);
-        if (ota_state == ESP_OTA_IMG_PENDING_VERIFY)
-        {
-            ESP_LOGI(TAG, "OTA state pending verify - running diagnostics...");
-            bool diagnostic_is_ok = diagnostic();
-            if (diagnostic_is_ok)
-            {
-                ESP_LOGI(TAG, "Diagnostics completed successfully! Continuing execution ...");
-                esp_ota_mark_app_valid_cancel_rollback();
-            }
-            else
-            {
-                ESP_LOGE(TAG, "Diagnostics failed! Start rollback to the previous version ...");
-                esp_ota_mark_app_invalid_rollback_and_reboot();
-            }
-        }
-        else
-        {
-            ESP_LOGI(TAG, "OTA state is %d, no action required.", ota_state);
-        }
+    esp_ota_handle_t handle;
+    const esp_partition_t *partition;
+    size_t written;
+    bool active;
+    otaHandler_preflight_t preflight;
+    mbedtls_sha256_context sha;
+    int64_t start_us;
+    bool suspended; // Client went away mid-upload, waiting for it to resume
+    int64_t suspended_us;
+} ota_session_t;
+
+static ota_session_t session;
+static const esp_partition_t *completed_partition = NULL;
+static portMUX_TYPE session_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Time spent inside esp_ota_write, which runs with the flash cache disabled
+typedef struct
+{
+    int64_t worst_stall_us;
+    int64_t busy_us;
+    int64_t idle_debt_us;
+    uint32_t operations;
+} flash_stats_t;
+
+static flash_stats_t flash_stats;
+
+// Staged images are activated here or by the application, see otaHandler_activateStaged
+static bool auto_reboot = CONFIG_SIMPLE_OTA_AUTO_REBOOT;
+static otaHandler_rebootCheck_t reboot_check = NULL;
+static esp_timer_handle_t reboot_timer = NULL;
+
+// SHA-256 of the bytes /firmware serves, per slot. esp_partition_get_sha256() returns the
+// appended image digest instead, which leaves out the trailing hash that is served too
+#define FIRMWARE_DIGEST_SLOTS 3
+typedef struct
+{
+    const esp_partition_t *partition;
+    size_t image_len;
+    uint8_t sha256[32];
+} firmware_digest_t;
+
+static firmware_digest_t firmware_digests[FIRMWARE_DIGEST_SLOTS];
+static size_t firmware_digest_next = 0;
+
+#define OTA_FLASH_SECTOR_SIZE 4096
+// Bytes written alongside a sector erase, so the erase is an operation of its own
+#define OTA_FLASH_ERASE_LEAD_BYTES 16
+
+esp_err_t otaHandler_sessionBegin(const otaHandler_preflight_t *preflight)
+{
+    portENTER_CRITICAL(&session_lock);
+    bool replace_suspended = session.active && session.suspended;
+    if (session.active && !replace_suspended)
+    {
+        portEXIT_CRITICAL(&session_lock);
+        ESP_LOGW(TAG, "OTA session already in progress");
+        return ESP_ERR_INVALID_STATE;
     }
-    else{
-        ESP_LOGI(TAG, "Normal execution ...");
+    session.active = true;
+    session.suspended = false;
+    portEXIT_CRITICAL(&session_lock);
+
+    // A new upload from the start replaces one waiting to be resumed
+    if (replace_suspended)
+    {
+        ESP_LOGW(TAG, "Abandoning suspended upload at %u bytes", (unsigned)session.written);
+        esp_ota_abort(session.handle);
+        mbedtls_sha256_free(&session.sha);
+    }
+
+    // The boot partition already points at the next slot, writing it now would corrupt that image
+    if (reboot_timer && esp_timer_is_active(reboot_timer))
+    {
+        ESP_LOGW(TAG, "Reboot into new firmware pending, not starting another update");
+        session.active = false;
+        return ESP_ERR_INVALID_STATE;
     }
-}
 
-esp_err_t otaHandler_updatePostHandler(httpd_req_t *req)
-{
-    esp_ota_handle_t ota_handle = 0;
-    const esp_partition_t *ota_partition = esp_ota_get_next_update_partition(NULL);
     const esp_partition_t *running_partition = esp_ota_get_running_partition();
-    esp_err_t err = ESP_OK;
-    bool ota_started = false;
+    session.partition = esp_ota_get_next_update_partition(NULL);
+    session.written = 0;
+    session.handle = 0;
+    completed_partition = NULL;
+    if (preflight)
+    {
+        session.preflight = *preflight;
+    }
+    else
+    {
+        memset(&session.preflight, 0, sizeof(session.preflight));
+    }
 
-    if (!ota_partition)
+    if (!session.partition)
     {
         ESP_LOGE(TAG, "No OTA partition found");
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-            "{\"error\":\"No OTA partition available\",\"details\":\"Device flash configuration issue\"}");
-        return ESP_FAIL;
+        session.active = false;
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (session.preflight.expected_size > session.partition->size)
+    {
+        ESP_LOGE(TAG, "Image of %u bytes does not fit partition %s (%u bytes)",
+                 (unsigned)session.preflight.expected_size, session.partition->label, (unsigned)session.partition->size);
+        session.active = false;
+        return ESP_ERR_INVALID_SIZE;
     }
 
     ESP_LOGI(TAG, "Starting OTA update. Running partition: %s, Target partition: %s",
-             running_partition->label, ota_partition->label);
+             running_partition->label, session.partition->label);
+
+    // The cached digest describes the image about to be erased
+    for (size_t i = 0; i < FIRMWARE_DIGEST_SLOTS; i++)
+    {
+        if (firmware_digests[i].partition == session.partition)
+        {
+            firmware_digests[i].partition = NULL;
+        }
+    }
 
-    // Begin OTA update
-    err = esp_ota_begin(ota_partition, OTA_SIZE_UNKNOWN, &ota_handle);
+#if CONFIG_SIMPLE_OTA_FLASH_PACING
+    // Erase sector by sector as the image arrives, never one long up-front erase
+    size_t image_size = OTA_WITH_SEQUENTIAL_WRITES;
+#else
+    // A known size lets esp_ota_begin erase only what the image needs
+    size_t image_size = session.preflight.expected_size ? session.preflight.expected_size : OTA_SIZE_UNKNOWN;
+#endif
+    flash_stats.worst_stall_us = 0;
+    flash_stats.busy_us = 0;
+    flash_stats.idle_debt_us = 0;
+    flash_stats.operations = 0;
+    esp_err_t err = esp_ota_begin(session.partition, image_size, &session.handle);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "esp_ota_begin failed, error=%d", err);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-            "{\"error\":\"Failed to start OTA update\",\"details\":\"Device memory or partition issue\"}");
-        return ESP_FAIL;
+        session.active = false;
+        return err;
     }
-    ota_started = true;
 
-    char buffer[512];
-    int received;
-    int total_received = 0;
-    bool first_chunk = true;
-    bool firmware_validated = false;
+    mbedtls_sha256_init(&session.sha);
+    mbedtls_sha256_starts(&session.sha, 0);
+    session.start_us = esp_timer_get_time();
 
-    // Receive firmware data in chunks
-    while ((received = httpd_req_recv(req, buffer, sizeof(buffer))) > 0)
+    return ESP_OK;
+}
+
+#if CONFIG_SIMPLE_OTA_RATE_LIMIT_KBPS > 0
+// Hold the writing task back so the transfer never runs ahead of the configured rate.
+// Blocking the receiver also lets TCP/UART flow control slow the sender down.
+static void pace_transfer(void)
+{
+    const int64_t bytes_per_second = (int64_t)CONFIG_SIMPLE_OTA_RATE_LIMIT_KBPS * 1024;
+    int64_t due_us = (int64_t)session.written * 1000000 / bytes_per_second;
+    int64_t ahead_us = due_us - (esp_timer_get_time() - session.start_us);
+    TickType_t ticks = pdMS_TO_TICKS(ahead_us / 1000);
+    if (ahead_us > 0 && ticks > 0)
+    {
+        vTaskDelay(ticks);
+    }
+}
+#endif
+
+static esp_err_t timed_flash_write(const uint8_t *data, size_t len)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(session.handle, (const void *)data, len);
+    int64_t busy_us = esp_timer_get_time() - start_us;
+
+    flash_stats.busy_us += busy_us;
+    flash_stats.operations++;
+    if (busy_us > flash_stats.worst_stall_us)
+    {
+        flash_stats.worst_stall_us = busy_us;
+    }
+
+#if CONFIG_SIMPLE_OTA_FLASH_PACING
+    // Owe enough idle time that busy / (busy + idle) stays within the duty cycle
+    flash_stats.idle_debt_us += busy_us * (100 - CONFIG_SIMPLE_OTA_FLASH_DUTY_PERCENT) / CONFIG_SIMPLE_OTA_FLASH_DUTY_PERCENT;
+    TickType_t ticks = pdMS_TO_TICKS(flash_stats.idle_debt_us / 1000);
+    if (ticks > 0)
     {
-        if (first_chunk)
+        int64_t sleep_start_us = esp_timer_get_time();
+        vTaskDelay(ticks);
+        flash_stats.idle_debt_us -= esp_timer_get_time() - sleep_start_us;
+        if (flash_stats.idle_debt_us < 0)
         {
-            // Validate firmware header on first chunk
-            if (!otaHandler_validateFirmware((uint8_t *)buffer, received))
-            {
-                ESP_LOGE(TAG, "Invalid firmware format");
-                if (ota_started)
-                    esp_ota_abort(ota_handle);
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, 
-                    "{\"error\":\"Invalid firmware file\",\"details\":\"File is not a valid ESP32 firmware. Ensure you're uploading a .bin file built for this device.\"}");
-                return ESP_FAIL;
-            }
-            firmware_validated = true;
+            flash_stats.idle_debt_us = 0;
+        }
+    }
+#endif
 
-            // Log the first 10 bytes for debugging
-            ESP_LOGI(TAG, "First 10 bytes: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
-                     buffer[0], buffer[1], buffer[2], buffer[3], buffer[4],
-                     buffer[5], buffer[6], buffer[7], buffer[8], buffer[9]);
+    return err;
+}
 
-            first_chunk = false;
+#if CONFIG_SIMPLE_OTA_FLASH_PACING
+// Feed esp_ota_write in slices that never cross a sector boundary, so each call
+// erases at most one sector or programs at most one slice, never both at length
+static esp_err_t paced_flash_write(const uint8_t *data, size_t len)
+{
+    size_t offset = session.written;
+    while (len > 0)
+    {
+        size_t slice = MIN(len, (size_t)CONFIG_SIMPLE_OTA_FLASH_SLICE_BYTES);
+        size_t sector_offset = offset % OTA_FLASH_SECTOR_SIZE;
+        if (sector_offset == 0)
+        {
+            slice = MIN(slice, (size_t)OTA_FLASH_ERASE_LEAD_BYTES);
         }
+        slice = MIN(slice, OTA_FLASH_SECTOR_SIZE - sector_offset);
 
-        // Write to the OTA partition
-        err = esp_ota_write(ota_handle, (const void *)buffer, received);
+        esp_err_t err = timed_flash_write(data, slice);
         if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "OTA Write Failed at offset %d, error=%d", total_received, err);
-            if (ota_started)
-                esp_ota_abort(ota_handle);
-            httpd_resp_set_type(req, "application/json");
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-                "{\"error\":\"Firmware write failed\",\"details\":\"Flash memory write error\"}");
-            return ESP_FAIL;
+            return err;
         }
-        total_received += received;
+        data += slice;
+        offset += slice;
+        len -= slice;
+    }
+    return ESP_OK;
+}
+#endif
 
-        // Log progress every 64KB
-        if (total_received % (64 * 1024) == 0)
+esp_err_t otaHandler_sessionWrite(const uint8_t *data, size_t len)
+{
+    if (!session.active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (session.written == 0)
+    {
+        // Validate firmware header on first chunk
+        if (!otaHandler_validateFirmware(data, len, &session.preflight))
         {
-            ESP_LOGI(TAG, "Received %d bytes", total_received);
+            ESP_LOGE(TAG, "Invalid firmware format");
+            otaHandler_sessionAbort();
+            return ESP_ERR_INVALID_ARG;
         }
+
+        // Log the first 10 bytes for debugging
+        ESP_LOGI(TAG, "First 10 bytes: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
+                 data[0], data[1], data[2], data[3], data[4],
+                 data[5], data[6], data[7], data[8], data[9]);
     }
 
-    if (received < 0)
+    // Write to the OTA partition
+#if CONFIG_SIMPLE_OTA_FLASH_PACING
+    esp_err_t err = paced_flash_write(data, len);
+#else
+    esp_err_t err = timed_flash_write(data, len);
+#endif
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "File reception failed! Error: %d", received);
-        if (ota_started)
-            esp_ota_abort(ota_handle);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-            "{\"error\":\"File reception failed\",\"details\":\"Network error during file upload\"}");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "OTA Write Failed at offset %u, error=%d", (unsigned)session.written, err);
+        otaHandler_sessionAbort();
+        return err;
+    }
+
+    mbedtls_sha256_update(&session.sha, data, len);
+
+    // Log progress every 64KB
+    if ((session.written + len) / (64 * 1024) != session.written / (64 * 1024))
+    {
+        ESP_LOGI(TAG, "Received %u bytes", (unsigned)(session.written + len));
+    }
+    session.written += len;
+
+#if CONFIG_SIMPLE_OTA_RATE_LIMIT_KBPS > 0
+    pace_transfer();
+#endif
+
+    return ESP_OK;
+}
+
+esp_err_t otaHandler_sessionFinish(void)
+{
+    if (!session.active)
+    {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    if (total_received == 0)
+    if (session.written == 0)
     {
         ESP_LOGE(TAG, "No data received");
-        if (ota_started)
-            esp_ota_abort(ota_handle);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, 
-            "{\"error\":\"No firmware data received\",\"details\":\"Empty file or upload interrupted\"}");
-        return ESP_FAIL;
+        otaHandler_sessionAbort();
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    if (!firmware_validated)
+    ESP_LOGI(TAG, "Total firmware size received: %u bytes", (unsigned)session.written);
+    ESP_LOGI(TAG, "Flash: %lu operations, %lld ms busy, worst stall %lld us",
+             (unsigned long)flash_stats.operations, (long long)(flash_stats.busy_us / 1000),
+             (long long)flash_stats.worst_stall_us);
+
+    if (session.preflight.expected_size && session.written != session.preflight.expected_size)
     {
-        ESP_LOGE(TAG, "Firmware validation failed");
-        if (ota_started)
-            esp_ota_abort(ota_handle);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, 
-            "{\"error\":\"Firmware validation failed\",\"details\":\"File format validation error\"}");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Expected %u bytes, received %u", (unsigned)session.preflight.expected_size, (unsigned)session.written);
+        otaHandler_sessionAbort();
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    ESP_LOGI(TAG, "Total firmware size received: %d bytes", total_received);
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&session.sha, digest);
+    if (session.preflight.has_sha256 && memcmp(digest, session.preflight.sha256, sizeof(digest)) != 0)
+    {
+        ESP_LOGE(TAG, "Firmware SHA-256 does not match the digest announced by the client");
+        otaHandler_sessionAbort();
+        return ESP_ERR_INVALID_CRC;
+    }
 
     // End OTA update
-    err = esp_ota_end(ota_handle);
+    esp_err_t err = esp_ota_end(session.handle);
+    mbedtls_sha256_free(&session.sha);
+    session.active = false;
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "esp_ota_end failed, error=%d", err);
@@ -196,35 +381,1203 @@ esp_err_t otaHandler_updatePostHandler(httpd_req_t *req)
         if (err == ESP_ERR_OTA_VALIDATE_FAILED)
         {
             ESP_LOGE(TAG, "Firmware signature verification failed - unauthorised firmware rejected");
-            httpd_resp_set_type(req, "application/json");
-            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
-                                "{\"error\":\"Firmware signature verification failed\",\"details\":\"This device requires signed firmware. Please use firmware built and signed with the authorised key.\"}");
-        }
-        else
-        {
-            httpd_resp_set_type(req, "application/json");
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-                "{\"error\":\"OTA finalisation failed\",\"details\":\"Internal error during firmware installation\"}");
         }
-        return ESP_FAIL;
+        return err;
+    }
+
+    completed_partition = session.partition;
+    return ESP_OK;
+}
+
+void otaHandler_sessionAbort(void)
+{
+    if (session.active)
+    {
+        esp_ota_abort(session.handle);
+        mbedtls_sha256_free(&session.sha);
+        session.active = false;
+        session.suspended = false;
+    }
+}
+
+size_t otaHandler_sessionWritten(void)
+{
+    return session.written;
+}
+
+#if CONFIG_SIMPLE_OTA_UPLOAD_RESUME
+static bool suspended_session_expired(void)
+{
+    return esp_timer_get_time() - session.suspended_us > (int64_t)CONFIG_SIMPLE_OTA_RESUME_TIMEOUT_S * 1000000;
+}
+#endif
+
+// A suspended upload nobody came back for keeps the session busy until it is dropped here
+static void abandon_expired_session(void)
+{
+#if CONFIG_SIMPLE_OTA_UPLOAD_RESUME
+    portENTER_CRITICAL(&session_lock);
+    bool expired = session.active && session.suspended && suspended_session_expired();
+    if (expired)
+    {
+        // Claimed, so a resume arriving now cannot pick it up while it is aborted
+        session.suspended = false;
+    }
+    portEXIT_CRITICAL(&session_lock);
+
+    if (expired)
+    {
+        ESP_LOGW(TAG, "Suspended upload at %u bytes expired, abandoning it", (unsigned)session.written);
+        otaHandler_sessionAbort();
+    }
+#endif
+}
+
+void otaHandler_sessionSuspend(void)
+{
+#if CONFIG_SIMPLE_OTA_UPLOAD_RESUME
+    // Without a digest a resuming client could not prove it is sending the same image
+    if (session.active && session.preflight.has_sha256 && session.written > 0)
+    {
+        session.suspended = true;
+        session.suspended_us = esp_timer_get_time();
+        ESP_LOGW(TAG, "Upload interrupted at %u bytes, resumable for %d s",
+                 (unsigned)session.written, CONFIG_SIMPLE_OTA_RESUME_TIMEOUT_S);
+        return;
+    }
+#endif
+    otaHandler_sessionAbort();
+}
+
+esp_err_t otaHandler_sessionResume(const otaHandler_preflight_t *preflight, size_t offset)
+{
+#if CONFIG_SIMPLE_OTA_UPLOAD_RESUME
+    portENTER_CRITICAL(&session_lock);
+    bool claimed = session.active && session.suspended;
+    session.suspended = false;
+    portEXIT_CRITICAL(&session_lock);
+
+    if (!claimed)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (suspended_session_expired())
+    {
+        ESP_LOGW(TAG, "Suspended upload expired, abandoning it");
+        otaHandler_sessionAbort();
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!preflight->has_sha256 || memcmp(preflight->sha256, session.preflight.sha256, sizeof(preflight->sha256)) != 0 ||
+        offset != session.written || preflight->expected_size != session.preflight.expected_size)
+    {
+        ESP_LOGW(TAG, "Resume at %u does not match the suspended upload at %u", (unsigned)offset, (unsigned)session.written);
+        session.suspended = true;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The rate limit does not count the time the client was away
+    session.start_us += esp_timer_get_time() - session.suspended_us;
+    ESP_LOGI(TAG, "Resuming upload at %u bytes", (unsigned)offset);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_FOUND;
+#endif
+}
+
+size_t otaHandler_sessionResumeOffset(uint8_t sha256[32])
+{
+    abandon_expired_session();
+#if CONFIG_SIMPLE_OTA_UPLOAD_RESUME
+    if (session.active && session.suspended)
+    {
+        memcpy(sha256, session.preflight.sha256, sizeof(session.preflight.sha256));
+        return session.written;
+    }
+#endif
+    return 0;
+}
+
+int64_t otaHandler_getWorstFlashStallUs(void)
+{
+    return flash_stats.worst_stall_us;
+}
+
+esp_err_t otaHandler_activateUpdate(void)
+{
+    if (!completed_partition)
+    {
+        return ESP_ERR_INVALID_STATE;
     }
-    ota_started = false;
 
     // Set OTA partition as boot partition
-    err = esp_ota_set_boot_partition(ota_partition);
+    esp_err_t err = esp_ota_set_boot_partition(completed_partition);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "OTA set boot partition failed, error=%d", err);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, 
-            "{\"error\":\"Boot partition update failed\",\"details\":\"Failed to set new firmware as boot partition\"}");
-        return ESP_FAIL;
     }
+    return err;
+}
 
-    ESP_LOGI(TAG, "Firmware update successful, rebooting...");
-    httpd_resp_sendstr(req, "Firmware update successful. Rebooting...");
-    vTaskDelay(pdMS_TO_TICKS(2000));
+bool otaHandler_hasStagedUpdate(void)
+{
+    abandon_expired_session();
+    return completed_partition != NULL && esp_ota_get_boot_partition() != completed_partition;
+}
+
+static void reboot_timer_callback(void *arg)
+{
+    if (reboot_check && !reboot_check())
+    {
+        // Application is busy, ask again shortly
+        esp_timer_start_once(reboot_timer, OTA_HANDLER_REBOOT_RETRY_MS * 1000);
+        return;
+    }
+    ESP_LOGI(TAG, "Rebooting into new firmware");
     esp_restart();
+}
+
+esp_err_t otaHandler_scheduleReboot(uint32_t delay_ms)
+{
+    if (!reboot_timer)
+    {
+        const esp_timer_create_args_t timer_args = {
+            .callback = reboot_timer_callback,
+            .name = "ota_reboot"};
+        esp_err_t err = esp_timer_create(&timer_args, &reboot_timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create reboot timer, error=%d", err);
+            return err;
+        }
+    }
+
+    // A later request replaces the earlier reboot time
+    esp_timer_stop(reboot_timer);
+    ESP_LOGI(TAG, "Reboot scheduled in %lu ms", (unsigned long)delay_ms);
+    return esp_timer_start_once(reboot_timer, (uint64_t)delay_ms * 1000);
+}
+
+esp_err_t otaHandler_activateStaged(uint32_t delay_ms)
+{
+    if (!otaHandler_hasStagedUpdate())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = otaHandler_activateUpdate();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return otaHandler_scheduleReboot(delay_ms);
+}
+
+void otaHandler_setAutoReboot(bool enable)
+{
+    auto_reboot = enable;
+}
+
+bool otaHandler_isAutoReboot(void)
+{
+    return auto_reboot;
+}
+
+void otaHandler_setRebootCheck(otaHandler_rebootCheck_t check)
+{
+    reboot_check = check;
+}
+
+bool otaHandler_isRunningImage(const uint8_t *data, size_t len)
+{
+    const size_t desc_offset = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t);
+    if (len < OTA_HANDLER_HEADER_BYTES)
+    {
+        return false;
+    }
+
+    esp_app_desc_t incoming;
+    memcpy(&incoming, data + desc_offset, sizeof(incoming));
+    if (incoming.magic_word != ESP_APP_DESC_MAGIC_WORD)
+    {
+        return false;
+    }
+
+    const esp_app_desc_t *running = esp_app_get_description();
+    return memcmp(incoming.app_elf_sha256, running->app_elf_sha256, sizeof(running->app_elf_sha256)) == 0;
+}
+
+static esp_err_t send_json_error(httpd_req_t *req, httpd_err_code_t code, const char *json)
+{
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send_err(req, code, json);
+    return ESP_FAIL;
+}
+
+// Request body as image bytes: received as is, or inflated on the fly for Content-Encoding: deflate
+typedef struct
+{
+    httpd_req_t *req;
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+    tinfl_decompressor *inflator; // NULL for a plain body
+    uint8_t *window;              // Circular TINFL_LZ_DICT_SIZE output window, input buffer after it
+    uint8_t *input;
+    size_t window_pos;
+    size_t output_pos; // Inflated bytes in the window not yet handed out
+    size_t output_len;
+    size_t input_pos;
+    size_t input_len;
+    bool input_done;
+    bool finished;
+#endif
+} upload_body_t;
 
+// A deflate stream that does not decode, distinct from the HTTPD_SOCK_ERR_* codes
+#define OTA_BODY_ERR_CORRUPT (-100)
+
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+#define OTA_INFLATE_INPUT_BYTES 1024
+
+static esp_err_t body_inflate_begin(upload_body_t *body)
+{
+    body->inflator = malloc(sizeof(tinfl_decompressor));
+    body->window = malloc(TINFL_LZ_DICT_SIZE + OTA_INFLATE_INPUT_BYTES);
+    if (!body->inflator || !body->window)
+    {
+        free(body->inflator);
+        free(body->window);
+        body->inflator = NULL;
+        body->window = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(body->inflator);
+    body->input = body->window + TINFL_LZ_DICT_SIZE;
+    body->window_pos = 0;
+    body->output_pos = 0;
+    body->output_len = 0;
+    body->input_pos = 0;
+    body->input_len = 0;
+    body->input_done = false;
+    body->finished = false;
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+static int body_inflate(upload_body_t *body, char *out, size_t cap)
+{
+    while (body->output_len == 0 && !body->finished)
+    {
+        if (body->input_pos == body->input_len && !body->input_done)
+        {
+            int received = httpd_req_recv(body->req, (char *)body->input, OTA_INFLATE_INPUT_BYTES);
+            if (received < 0)
+            {
+                return received;
+            }
+            body->input_pos = 0;
+            body->input_len = received;
+            body->input_done = received == 0;
+        }
+
+        // tinfl needs the output span to end at the window boundary, it wraps by masking
+        size_t in_bytes = body->input_len - body->input_pos;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - body->window_pos;
+        uint32_t flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (body->input_done ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+        tinfl_status status = tinfl_decompress(body->inflator, body->input + body->input_pos, &in_bytes,
+                                               body->window, body->window + body->window_pos, &out_bytes, flags);
+        body->input_pos += in_bytes;
+        if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_NEEDS_MORE_INPUT && body->input_done))
+        {
+            ESP_LOGE(TAG, "Compressed upload is corrupt or truncated, status %d", status);
+            return OTA_BODY_ERR_CORRUPT;
+        }
+        body->finished = status == TINFL_STATUS_DONE;
+        body->output_pos = body->window_pos;
+        body->output_len = out_bytes;
+        body->window_pos = (body->window_pos + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    size_t len = MIN(cap, body->output_len);
+    memcpy(out, body->window + body->output_pos, len);
+    body->output_pos += len;
+    body->output_len -= len;
+    return len;
+}
+#endif
+
+static int body_read(upload_body_t *body, char *buffer, size_t cap)
+{
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+    if (body->inflator)
+    {
+        return body_inflate(body, buffer, cap);
+    }
+#endif
+    return httpd_req_recv(body->req, buffer, cap);
+}
+
+static void body_end(upload_body_t *body)
+{
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+    free(body->inflator);
+    free(body->window);
+    body->inflator = NULL;
+    body->window = NULL;
+#endif
+}
+
+// Read until at least want bytes are buffered or the body ends
+static int recv_at_least(upload_body_t *body, char *buffer, size_t want, size_t cap)
+{
+    size_t filled = 0;
+    while (filled < want)
+    {
+        int received = body_read(body, buffer + filled, cap - filled);
+        if (received < 0)
+        {
+            return received;
+        }
+        if (received == 0)
+        {
+            break;
+        }
+        filled += received;
+    }
+    return filled;
+}
+
+static bool query_flag_set(httpd_req_t *req, const char *key)
+{
+    char query[64];
+    char value[8];
+    return httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+           httpd_query_key_value(query, key, value, sizeof(value)) == ESP_OK &&
+           strcmp(value, "1") == 0;
+}
+
+static uint32_t query_uint(httpd_req_t *req, const char *key, uint32_t fallback)
+{
+    char query[64];
+    char value[12];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK)
+    {
+        return fallback;
+    }
+    return (uint32_t)strtoul(value, NULL, 10);
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool body_is_deflate(httpd_req_t *req)
+{
+    char value[16];
+    return httpd_req_get_hdr_value_str(req, "Content-Encoding", value, sizeof(value)) == ESP_OK &&
+           strcmp(value, "deflate") == 0;
+}
+
+// Digest, chip id and size announced by the client pre-flight, all optional. Without
+// X-Firmware-Size the size is the body length, plus the offset of a resumed upload.
+static void read_preflight_headers(httpd_req_t *req, size_t offset, bool deflate, otaHandler_preflight_t *preflight)
+{
+    char value[72];
+
+    memset(preflight, 0, sizeof(*preflight));
+    preflight->expected_size = deflate ? 0 : offset + req->content_len;
+
+    if (httpd_req_get_hdr_value_str(req, "X-Firmware-Size", value, sizeof(value)) == ESP_OK)
+    {
+        preflight->expected_size = strtoul(value, NULL, 10);
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "X-Firmware-SHA256", value, sizeof(value)) == ESP_OK && strlen(value) == 64)
+    {
+        preflight->has_sha256 = true;
+        for (int i = 0; i < 32; i++)
+        {
+            int hi = hex_nibble(value[i * 2]);
+            int lo = hex_nibble(value[i * 2 + 1]);
+            if (hi < 0 || lo < 0)
+            {
+                preflight->has_sha256 = false;
+                break;
+            }
+            preflight->sha256[i] = (hi << 4) | lo;
+        }
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "X-Firmware-Chip-Id", value, sizeof(value)) == ESP_OK)
+    {
+        preflight->has_chip_id = true;
+        preflight->chip_id = (uint16_t)strtoul(value, NULL, 0);
+    }
+}
+
+// 416 with the offset the client should resume from, 0 meaning start again
+static esp_err_t send_resume_error(httpd_req_t *req)
+{
+    uint8_t sha256[32];
+    char response[160];
+    snprintf(response, sizeof(response),
+             "{\"error\":\"Cannot resume upload\",\"details\":\"No matching interrupted upload at this offset\",\"resume_offset\":%u}",
+             (unsigned)otaHandler_sessionResumeOffset(sha256));
+    httpd_resp_set_status(req, "416 Range Not Satisfiable");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, response);
+    return ESP_FAIL;
+}
+
+static esp_err_t receive_upload(httpd_req_t *req, upload_body_t *body)
+{
+    char buffer[512];
+    otaHandler_preflight_t preflight;
+    size_t offset = query_uint(req, "offset", 0);
+    bool deflate = body_is_deflate(req);
+
+    read_preflight_headers(req, offset, deflate, &preflight);
+
+    // Reject from the announced metadata alone, before any body bytes use air time
+    if (preflight.has_chip_id && preflight.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID)
+    {
+        ESP_LOGE(TAG, "Upload announced chip id %d, this device is %d", preflight.chip_id, CONFIG_IDF_FIRMWARE_CHIP_ID);
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"Wrong chip\",\"details\":\"This firmware is built for a different ESP32 variant.\"}");
+    }
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (target && preflight.expected_size > target->size)
+    {
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_sendstr(req, "{\"error\":\"File too large\",\"details\":\"Firmware does not fit the OTA partition\"}");
+        return ESP_FAIL;
+    }
+
+    if (deflate)
+    {
+#if CONFIG_SIMPLE_OTA_UPLOAD_INFLATE
+        if (body_inflate_begin(body) != ESP_OK)
+        {
+            return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                "{\"error\":\"Out of memory\",\"details\":\"Not enough heap to inflate a compressed upload, send it uncompressed\"}");
+        }
+#else
+        httpd_resp_set_status(req, "415 Unsupported Media Type");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_sendstr(req, "{\"error\":\"Compression not supported\",\"details\":\"Send the image uncompressed\"}");
+        return ESP_FAIL;
+#endif
+    }
+
+    int received;
+    esp_err_t err;
+    if (offset > 0)
+    {
+        // The image was identified and checked when the upload first started
+        if (otaHandler_sessionResume(&preflight, offset) != ESP_OK)
+        {
+            return send_resume_error(req);
+        }
+        received = body_read(body, buffer, sizeof(buffer));
+    }
+    else
+    {
+        // Look at the app descriptor before esp_ota_begin erases anything
+        received = recv_at_least(body, buffer, OTA_HANDLER_HEADER_BYTES, sizeof(buffer));
+        if (received == OTA_BODY_ERR_CORRUPT)
+        {
+            return send_json_error(req, HTTPD_400_BAD_REQUEST,
+                "{\"error\":\"Invalid compressed data\",\"details\":\"The deflate stream could not be decoded\"}");
+        }
+        if (received < 0)
+        {
+            ESP_LOGE(TAG, "File reception failed! Error: %d", received);
+            return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                "{\"error\":\"File reception failed\",\"details\":\"Network error during file upload\"}");
+        }
+        if (received == 0)
+        {
+            ESP_LOGE(TAG, "No data received");
+            return send_json_error(req, HTTPD_400_BAD_REQUEST,
+                "{\"error\":\"No firmware data received\",\"details\":\"Empty file or upload interrupted\"}");
+        }
+
+        if (otaHandler_isRunningImage((const uint8_t *)buffer, received) && !query_flag_set(req, "force"))
+        {
+            ESP_LOGW(TAG, "Uploaded firmware is already running, skipping update");
+            httpd_resp_set_status(req, "409 Conflict");
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_sendstr(req, "{\"error\":\"Firmware already installed\",\"details\":\"The device is already running this image. Upload with force=1 to reinstall it.\"}");
+            return ESP_OK;
+        }
+
+        err = otaHandler_sessionBegin(&preflight);
+        if (err == ESP_ERR_NOT_FOUND)
+        {
+            return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                "{\"error\":\"No OTA partition available\",\"details\":\"Device flash configuration issue\"}");
+        }
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_sendstr(req, "{\"error\":\"Device busy\",\"details\":\"Another firmware update is in progress\"}");
+            return ESP_FAIL;
+        }
+        if (err != ESP_OK)
+        {
+            return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                "{\"error\":\"Failed to start OTA update\",\"details\":\"Device memory or partition issue\"}");
+        }
+    }
+
+    // Receive firmware data in chunks
+    while (received > 0)
+    {
+        err = otaHandler_sessionWrite((const uint8_t *)buffer, received);
+        if (err == ESP_ERR_INVALID_ARG)
+        {
+            return send_json_error(req, HTTPD_400_BAD_REQUEST,
+                "{\"error\":\"Invalid firmware file\",\"details\":\"File is not a valid ESP32 firmware. Ensure you're uploading a .bin file built for this device.\"}");
+        }
+        if (err != ESP_OK)
+        {
+            return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                "{\"error\":\"Firmware write failed\",\"details\":\"Flash memory write error\"}");
+        }
+        received = body_read(body, buffer, sizeof(buffer));
+    }
+
+    if (received == OTA_BODY_ERR_CORRUPT)
+    {
+        otaHandler_sessionAbort();
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"Invalid compressed data\",\"details\":\"The deflate stream could not be decoded\"}");
+    }
+    if (received < 0)
+    {
+        ESP_LOGE(TAG, "File reception failed! Error: %d", received);
+        // Kept for a resume when the client announced a digest
+        otaHandler_sessionSuspend();
+        return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+            "{\"error\":\"File reception failed\",\"details\":\"Network error during file upload\"}");
+    }
+
+    err = otaHandler_sessionFinish();
+    if (err == ESP_ERR_INVALID_SIZE)
+    {
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"No firmware data received\",\"details\":\"Empty file or upload interrupted\"}");
+    }
+    if (err == ESP_ERR_INVALID_CRC)
+    {
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"Firmware digest mismatch\",\"details\":\"The received image does not match the SHA-256 computed before upload. Please retry.\"}");
+    }
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED)
+    {
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"Firmware signature verification failed\",\"details\":\"This device requires signed firmware. Please use firmware built and signed with the authorised key.\"}");
+    }
+    if (err != ESP_OK)
+    {
+        return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+            "{\"error\":\"OTA finalisation failed\",\"details\":\"Internal error during firmware installation\"}");
+    }
+
+    char response[96];
+    httpd_resp_set_type(req, "application/json");
+
+    if (!auto_reboot)
+    {
+        ESP_LOGI(TAG, "Firmware staged in %s, waiting for activation", completed_partition->label);
+        snprintf(response, sizeof(response), "{\"status\":\"staged\",\"partition\":\"%s\"}", completed_partition->label);
+        return httpd_resp_sendstr(req, response);
+    }
+
+    // The reboot runs from a timer, so this response is flushed straight away
+    if (otaHandler_activateStaged(OTA_HANDLER_REBOOT_FLUSH_MS) != ESP_OK)
+    {
+        return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+            "{\"error\":\"Boot partition update failed\",\"details\":\"Failed to set new firmware as boot partition\"}");
+    }
+
+    ESP_LOGI(TAG, "Firmware update successful, rebooting...");
+    snprintf(response, sizeof(response), "{\"status\":\"activated\",\"reboot_in_ms\":%d}", OTA_HANDLER_REBOOT_FLUSH_MS);
+    return httpd_resp_sendstr(req, response);
+}
+
+esp_err_t otaHandler_updatePostHandler(httpd_req_t *req)
+{
+    upload_body_t body = {.req = req};
+    esp_err_t err = receive_upload(req, &body);
+    body_end(&body);
+    return err;
+}
+
+esp_err_t otaHandler_activatePostHandler(httpd_req_t *req)
+{
+    uint32_t delay_ms = query_uint(req, "delay_ms", OTA_HANDLER_REBOOT_FLUSH_MS);
+
+    esp_err_t err = otaHandler_activateStaged(delay_ms);
+    if (err == ESP_ERR_INVALID_STATE)
+    {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, "{\"error\":\"Nothing to activate\",\"details\":\"No staged firmware. Upload an image first.\"}");
+    }
+    if (err != ESP_OK)
+    {
+        return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+            "{\"error\":\"Activation failed\",\"details\":\"Failed to set staged firmware as boot partition\"}");
+    }
+
+    char response[64];
+    snprintf(response, sizeof(response), "{\"status\":\"activated\",\"reboot_in_ms\":%lu}", (unsigned long)delay_ms);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, response);
+}
+
+// Resolve running|next|other|<label> to an app partition
+static const esp_partition_t *slot_from_name(const char *slot)
+{
+    if (strcmp(slot, "next") == 0 || strcmp(slot, "other") == 0)
+    {
+        return esp_ota_get_next_update_partition(NULL);
+    }
+    if (strcmp(slot, "running") == 0)
+    {
+        return esp_ota_get_running_partition();
+    }
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, slot);
+}
+
+// Resolve ?slot= to an app partition. The default is the staged image while there is one,
+// so a mirror neighbour gets the new firmware rather than the one still running here
+static const esp_partition_t *firmware_slot_from_query(httpd_req_t *req)
+{
+    char query[64];
+    char slot[17];
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "slot", slot, sizeof(slot)) == ESP_OK)
+    {
+        return slot_from_name(slot);
+    }
+    if (otaHandler_hasStagedUpdate())
+    {
+        return completed_partition;
+    }
+    return esp_ota_get_running_partition();
+}
+
+// Parse a single "bytes=a-b", "bytes=a-" or "bytes=-n" range, clamped to image_len
+static bool firmware_parse_range(const char *header, size_t image_len, size_t *start, size_t *end)
+{
+    if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',') != NULL)
+    {
+        return false;
+    }
+
+    const char *spec = header + 6;
+    char *dash;
+    if (*spec == '-')
+    {
+        unsigned long suffix = strtoul(spec + 1, &dash, 10);
+        if (suffix == 0 || *dash != '\0')
+            return false;
+        *start = suffix >= image_len ? 0 : image_len - suffix;
+        *end = image_len - 1;
+        return true;
+    }
+
+    unsigned long first = strtoul(spec, &dash, 10);
+    if (*dash != '-' || first >= image_len)
+        return false;
+
+    unsigned long last = image_len - 1;
+    if (dash[1] != '\0')
+    {
+        char *tail;
+        last = strtoul(dash + 1, &tail, 10);
+        if (*tail != '\0' || last < first)
+            return false;
+        if (last >= image_len)
+            last = image_len - 1;
+    }
+
+    *start = first;
+    *end = last;
+    return true;
+}
+
+// Map the MMU-aligned window holding offset, *ptr points at offset and *len runs to the window end
+static esp_err_t firmware_map(const esp_partition_t *partition, size_t offset, const uint8_t **ptr, size_t *len,
+                              esp_partition_mmap_handle_t *handle)
+{
+    size_t window_start = offset & ~(size_t)(FIRMWARE_MMAP_WINDOW - 1);
+    size_t window_len = MIN((size_t)FIRMWARE_MMAP_WINDOW, partition->size - window_start);
+    const void *window_ptr;
+
+    esp_err_t err = esp_partition_mmap(partition, window_start, window_len, ESP_PARTITION_MMAP_DATA, &window_ptr, handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map %s at 0x%x, error=%d", partition->label, (unsigned)window_start, err);
+        return err;
+    }
+    *ptr = (const uint8_t *)window_ptr + (offset - window_start);
+    *len = window_start + window_len - offset;
+    return ESP_OK;
+}
+
+// Digest of bytes 0..image_len-1 exactly as served, hashed once per slot and image
+static esp_err_t firmware_digest(const esp_partition_t *partition, size_t image_len, uint8_t sha256[32])
+{
+    for (size_t i = 0; i < FIRMWARE_DIGEST_SLOTS; i++)
+    {
+        if (firmware_digests[i].partition == partition && firmware_digests[i].image_len == image_len)
+        {
+            memcpy(sha256, firmware_digests[i].sha256, 32);
+            return ESP_OK;
+        }
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    esp_err_t err = ESP_OK;
+    for (size_t offset = 0; offset < image_len && err == ESP_OK;)
+    {
+        const uint8_t *ptr;
+        size_t len;
+        esp_partition_mmap_handle_t handle;
+        err = firmware_map(partition, offset, &ptr, &len, &handle);
+        if (err == ESP_OK)
+        {
+            len = MIN(len, image_len - offset);
+            mbedtls_sha256_update(&sha, ptr, len);
+            esp_partition_munmap(handle);
+            offset += len;
+        }
+    }
+    mbedtls_sha256_finish(&sha, sha256);
+    mbedtls_sha256_free(&sha);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // Not cached while an upload is writing this slot, the image is about to change
+    if (!(session.active && session.partition == partition))
+    {
+        firmware_digest_t *entry = &firmware_digests[firmware_digest_next];
+        firmware_digest_next = (firmware_digest_next + 1) % FIRMWARE_DIGEST_SLOTS;
+        entry->partition = partition;
+        entry->image_len = image_len;
+        memcpy(entry->sha256, sha256, 32);
+    }
+    return ESP_OK;
+}
+
+esp_err_t otaHandler_firmwareGetHandler(httpd_req_t *req)
+{
+    const esp_partition_t *partition = firmware_slot_from_query(req);
+    if (!partition || partition->type != ESP_PARTITION_TYPE_APP)
+    {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND,
+            "{\"error\":\"Firmware slot not found\",\"details\":\"Use slot=running, slot=next or an app partition label\"}");
+        return ESP_FAIL;
+    }
+
+    // Trim to the real image, not the whole partition
+    esp_partition_pos_t part_pos = {
+        .offset = partition->address,
+        .size = partition->size};
+    esp_image_metadata_t metadata;
+    if (esp_image_get_metadata(&part_pos, &metadata) != ESP_OK || metadata.image_len == 0)
+    {
+        ESP_LOGE(TAG, "No valid image in partition %s", partition->label);
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND,
+            "{\"error\":\"No valid firmware image\",\"details\":\"The selected slot does not contain a bootable image\"}");
+        return ESP_FAIL;
+    }
+    const size_t image_len = metadata.image_len;
+
+    uint8_t sha256[32];
+    char sha256_hex[65] = {0};
+    if (firmware_digest(partition, image_len, sha256) == ESP_OK)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            sprintf(&sha256_hex[i * 2], "%02x", sha256[i]);
+        }
+    }
+
+    size_t start = 0;
+    size_t end = image_len - 1;
+    char range_hdr[64];
+    char content_range[64];
+    char length_hdr[16];
+    char etag[68] = "";
+    char if_range[72];
+    bool partial = false;
+
+    // The image digest names this exact image; a Range with a stale If-Range gets all of it
+    if (sha256_hex[0])
+    {
+        snprintf(etag, sizeof(etag), "\"%s\"", sha256_hex);
+    }
+    bool range_valid = httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+                       (etag[0] && strcmp(if_range, etag) == 0);
+
+    if (range_valid && httpd_req_get_hdr_value_str(req, "Range", range_hdr, sizeof(range_hdr)) == ESP_OK)
+    {
+        if (!firmware_parse_range(range_hdr, image_len, &start, &end))
+        {
+            snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned)image_len);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", content_range);
+            httpd_resp_send(req, NULL, 0);
+            return ESP_OK;
+        }
+        partial = true;
+        snprintf(content_range, sizeof(content_range), "bytes %u-%u/%u",
+                 (unsigned)start, (unsigned)end, (unsigned)image_len);
+        httpd_resp_set_status(req, "206 Partial Content");
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+    }
+
+    snprintf(length_hdr, sizeof(length_hdr), "%u", (unsigned)image_len);
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "X-Firmware-Length", length_hdr);
+    httpd_resp_set_hdr(req, "X-Firmware-Partition", partition->label);
+    if (sha256_hex[0])
+    {
+        httpd_resp_set_hdr(req, "X-Firmware-SHA256", sha256_hex);
+        httpd_resp_set_hdr(req, "ETag", etag);
+    }
+
+    ESP_LOGI(TAG, "Serving firmware from %s, bytes %u-%u of %u%s", partition->label,
+             (unsigned)start, (unsigned)end, (unsigned)image_len, partial ? " (range)" : "");
+
+    // Stream straight out of memory-mapped flash, one MMU-aligned window at a time
+    size_t offset = start;
+    while (offset <= end)
+    {
+        const uint8_t *ptr;
+        size_t len;
+        esp_partition_mmap_handle_t mmap_handle;
+        if (firmware_map(partition, offset, &ptr, &len, &mmap_handle) != ESP_OK)
+        {
+            httpd_resp_send_chunk(req, NULL, 0);
+            return ESP_FAIL;
+        }
+
+        size_t send_len = MIN(len, end + 1 - offset);
+        esp_err_t err = httpd_resp_send_chunk(req, (const char *)ptr, send_len);
+        esp_partition_munmap(mmap_handle);
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Firmware download aborted by client at offset %u", (unsigned)offset);
+            return ESP_FAIL;
+        }
+        offset += send_len;
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const char *partition_type_name(const esp_partition_t *partition)
+{
+    if (partition->type == ESP_PARTITION_TYPE_APP)
+    {
+        return "app";
+    }
+    return partition->type == ESP_PARTITION_TYPE_DATA ? "data" : "other";
+}
+
+esp_err_t otaHandler_infoGetHandler(httpd_req_t *req)
+{
+    const esp_app_desc_t *app = esp_app_get_description();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    esp_chip_info_t chip;
+    esp_chip_info(&chip);
+
+    char elf_sha[65];
+    for (int i = 0; i < 32; i++)
+    {
+        sprintf(&elf_sha[i * 2], "%02x", app->app_elf_sha256[i]);
+    }
+
+    char json[768];
+    snprintf(json, sizeof(json),
+             "{\"app\":{\"version\":\"%s\",\"project\":\"%s\",\"idf\":\"%s\",\"date\":\"%s\",\"time\":\"%s\","
+             "\"elf_sha256\":\"%s\",\"secure_version\":%lu},"
+             "\"chip\":{\"target\":\"%s\",\"chip_id\":%d,\"revision\":%d,\"cores\":%d},"
+             "\"running_partition\":\"%s\",\"next_partition\":\"%s\",\"free_slot_size\":%lu,"
+             "\"max_upload_size\":%d,\"worst_flash_stall_us\":%lld,\"auto_reboot\":%s,\"staged\":%s,"
+             "\"health_pending\":%s,\"boot_to_valid_ms\":%lld,",
+             app->version, app->project_name, app->idf_ver, app->date, app->time,
+             elf_sha, (unsigned long)app->secure_version,
+             CONFIG_IDF_TARGET, CONFIG_IDF_FIRMWARE_CHIP_ID, chip.revision, chip.cores,
+             running ? running->label : "", next ? next->label : "",
+             (unsigned long)(next ? next->size : 0),
+             CONFIG_SIMPLE_OTA_MAX_FILE_SIZE_MB * 1024 * 1024,
+             (long long)otaHandler_getWorstFlashStallUs(),
+             auto_reboot ? "true" : "false", otaHandler_hasStagedUpdate() ? "true" : "false",
+             healthCheck_isPending() ? "true" : "false", (long long)healthCheck_getBootToValidMs());
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, json);
+
+    // Interrupted upload waiting for its client, and whether compressed uploads are accepted
+    uint8_t resume_sha[32];
+    char resume_sha_hex[65] = "";
+    size_t resume_offset = otaHandler_sessionResumeOffset(resume_sha);
+    for (int i = 0; resume_offset > 0 && i < 32; i++)
+    {
+        sprintf(&resume_sha_hex[i * 2], "%02x", resume_sha[i]);
+    }
+    snprintf(json, sizeof(json),
+             "\"upload\":{\"resume_offset\":%u,\"resume_sha256\":\"%s\",\"deflate\":%s},\"partitions\":[",
+             (unsigned)resume_offset, resume_sha_hex, OTA_UPLOAD_DEFLATE ? "true" : "false");
+    httpd_resp_sendstr_chunk(req, json);
+
+    // Partition table, one entry per chunk
+    bool first = true;
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it != NULL; it = esp_partition_next(it))
+    {
+        const esp_partition_t *partition = esp_partition_get(it);
+        snprintf(json, sizeof(json),
+                 "%s{\"label\":\"%s\",\"type\":\"%s\",\"subtype\":%d,\"address\":%lu,\"size\":%lu}",
+                 first ? "" : ",", partition->label, partition_type_name(partition), partition->subtype,
+                 (unsigned long)partition->address, (unsigned long)partition->size);
+        httpd_resp_sendstr_chunk(req, json);
+        first = false;
+    }
+    esp_partition_iterator_release(it);
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static void fill_slot_info(const esp_partition_t *partition, simple_ota_slot_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    strncpy(info->label, partition->label, sizeof(info->label) - 1);
+    info->address = partition->address;
+    info->size = partition->size;
+    info->running = partition == esp_ota_get_running_partition();
+    info->boot = partition == esp_ota_get_boot_partition();
+    info->has_app = esp_ota_get_partition_description(partition, &info->app) == ESP_OK;
+    info->has_state = esp_ota_get_state_partition(partition, &info->state) == ESP_OK;
+
+    if (info->has_app)
+    {
+        // Full hash (and signature) check, the same one the bootloader applies
+        esp_partition_pos_t part_pos = {
+            .offset = partition->address,
+            .size = partition->size};
+        esp_image_metadata_t metadata;
+        info->valid = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &part_pos, &metadata) == ESP_OK;
+    }
+}
+
+esp_err_t otaHandler_listSlots(simple_ota_slot_info_t *slots, size_t max_slots, size_t *count)
+{
+    size_t found = 0;
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it != NULL; it = esp_partition_next(it))
+    {
+        if (found < max_slots)
+        {
+            fill_slot_info(esp_partition_get(it), &slots[found]);
+        }
+        found++;
+    }
+    esp_partition_iterator_release(it);
+
+    *count = found;
+    return ESP_OK;
+}
+
+esp_err_t otaHandler_switchToSlot(const esp_partition_t *partition, uint32_t delay_ms)
+{
+    if (!partition || partition->type != ESP_PARTITION_TYPE_APP)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    abandon_expired_session();
+    if (session.active)
+    {
+        ESP_LOGW(TAG, "Update in progress, not switching slots");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Back to the running firmware: undo any activation, nothing to reboot for
+    if (partition == esp_ota_get_running_partition())
+    {
+        if (reboot_timer)
+        {
+            esp_timer_stop(reboot_timer);
+        }
+        return esp_ota_set_boot_partition(partition);
+    }
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(partition, &state) == ESP_OK &&
+        (state == ESP_OTA_IMG_INVALID || state == ESP_OTA_IMG_ABORTED))
+    {
+        ESP_LOGE(TAG, "Image in %s was rolled back, not booting it", partition->label);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_partition_pos_t part_pos = {
+        .offset = partition->address,
+        .size = partition->size};
+    esp_image_metadata_t metadata;
+    if (esp_image_verify(ESP_IMAGE_VERIFY, &part_pos, &metadata) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Image in %s failed verification", partition->label);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    esp_err_t err = esp_ota_set_boot_partition(partition);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "OTA set boot partition failed, error=%d", err);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Switching to firmware in %s", partition->label);
+    return otaHandler_scheduleReboot(delay_ms);
+}
+
+static const char *slot_state_name(const simple_ota_slot_info_t *info)
+{
+    if (!info->has_state)
+    {
+        return "none";
+    }
+    switch (info->state)
+    {
+    case ESP_OTA_IMG_NEW:
+        return "new";
+    case ESP_OTA_IMG_PENDING_VERIFY:
+        return "pending_verify";
+    case ESP_OTA_IMG_VALID:
+        return "valid";
+    case ESP_OTA_IMG_INVALID:
+        return "invalid";
+    case ESP_OTA_IMG_ABORTED:
+        return "aborted";
+    default:
+        return "undefined";
+    }
+}
+
+esp_err_t otaHandler_slotsGetHandler(httpd_req_t *req)
+{
+    // One slot on the stack at a time, esp_app_desc_t alone is 256 bytes
+    simple_ota_slot_info_t info;
+    char json[512];
+    bool first = true;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr_chunk(req, "{\"slots\":[");
+
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it != NULL; it = esp_partition_next(it))
+    {
+        fill_slot_info(esp_partition_get(it), &info);
+
+        int len = snprintf(json, sizeof(json),
+                           "%s{\"label\":\"%s\",\"address\":%lu,\"size\":%lu,\"running\":%s,\"boot\":%s,"
+                           "\"state\":\"%s\",\"valid\":%s,\"app\":",
+                           first ? "" : ",", info.label, (unsigned long)info.address, (unsigned long)info.size,
+                           info.running ? "true" : "false", info.boot ? "true" : "false",
+                           slot_state_name(&info), info.valid ? "true" : "false");
+        if (info.has_app)
+        {
+            char elf_sha[65];
+            for (int i = 0; i < 32; i++)
+            {
+                sprintf(&elf_sha[i * 2], "%02x", info.app.app_elf_sha256[i]);
+            }
+            snprintf(json + len, sizeof(json) - len,
+                     "{\"version\":\"%s\",\"project\":\"%s\",\"idf\":\"%s\",\"date\":\"%s\",\"time\":\"%s\","
+                     "\"elf_sha256\":\"%s\",\"secure_version\":%lu}}",
+                     info.app.version, info.app.project_name, info.app.idf_ver, info.app.date, info.app.time,
+                     elf_sha, (unsigned long)info.app.secure_version);
+        }
+        else
+        {
+            snprintf(json + len, sizeof(json) - len, "null}");
+        }
+        httpd_resp_sendstr_chunk(req, json);
+        first = false;
+    }
+    esp_partition_iterator_release(it);
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+esp_err_t otaHandler_slotSwitchPostHandler(httpd_req_t *req)
+{
+    char query[64];
+    char slot[17];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "slot", slot, sizeof(slot)) != ESP_OK)
+    {
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"No slot given\",\"details\":\"Use slot=next or an app partition label\"}");
+    }
+
+    const esp_partition_t *partition = slot_from_name(slot);
+    uint32_t delay_ms = query_uint(req, "delay_ms", OTA_HANDLER_REBOOT_FLUSH_MS);
+
+    esp_err_t err = otaHandler_switchToSlot(partition, delay_ms);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        return send_json_error(req, HTTPD_404_NOT_FOUND,
+            "{\"error\":\"Firmware slot not found\",\"details\":\"Use slot=next or an app partition label\"}");
+    }
+    if (err == ESP_ERR_IMAGE_INVALID)
+    {
+        return send_json_error(req, HTTPD_400_BAD_REQUEST,
+            "{\"error\":\"Invalid firmware image\",\"details\":\"The image in this slot failed verification\"}");
+    }
+    if (err == ESP_ERR_INVALID_STATE)
+    {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, "{\"error\":\"Slot not bootable now\",\"details\":\"The image was rolled back or an update is in progress\"}");
+    }
+    if (err != ESP_OK)
+    {
+        return send_json_error(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+            "{\"error\":\"Slot switch failed\",\"details\":\"Failed to set boot partition\"}");
+    }
+
+    char response[96];
+    bool rebooting = partition != esp_ota_get_running_partition();
+    snprintf(response, sizeof(response), "{\"status\":\"%s\",\"partition\":\"%s\",\"reboot_in_ms\":%lu}",
+             rebooting ? "switching" : "current", partition->label, rebooting ? (unsigned long)delay_ms : 0UL);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, response);
+}
@@ -0,0 +1,630 @@
+#include "otaPull.h"
+
+#if CONFIG_SIMPLE_OTA_PULL
+
+#include "otaHandler.h"
+#include "otaTask.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_http_client.h"
+#include "esp_app_format.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *TAG = "OTA_PULL";
+
+#define PULL_BLOCK_SIZE 4096
+#define PULL_BLOCK_COUNT CONFIG_SIMPLE_OTA_PULL_PIPELINE_DEPTH
+#define PULL_MANIFEST_MAX 1024
+#define PULL_URL_MAX 256
+
+typedef struct
+{
+    esp_http_client_handle_t client;
+    const char *url;
+    size_t offset;      // Bytes handed to the caller so far
+    int64_t total;      // Image length from the first response, -1 if unknown
+    int resumes;
+    // Announced by a simpleOTA /firmware source, empty / -1 from plain servers
+    char firmware_sha256[65];
+    int64_t firmware_length;
+    // Validators of the current response, and the one of the first response sent as If-Range
+    char etag[64];
+    char last_modified[40];
+    char validator[64];
+    int64_t range_start; // First byte of a 206 response's Content-Range, -1 if absent
+} pull_stream_t;
+
+typedef struct
+{
+    uint8_t index;
+    uint16_t len;       // 0 marks end of stream
+} pull_block_t;
+
+// Download and flash writes overlap: the caller fills blocks while the writer task flashes them
+static uint8_t pull_blocks[PULL_BLOCK_COUNT][PULL_BLOCK_SIZE];
+static QueueHandle_t free_queue = NULL;
+static QueueHandle_t filled_queue = NULL;
+static SemaphoreHandle_t writer_done = NULL;
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+static StaticQueue_t free_queue_buffer;
+static StaticQueue_t filled_queue_buffer;
+static StaticSemaphore_t writer_done_buffer;
+static uint8_t free_queue_storage[PULL_BLOCK_COUNT * sizeof(pull_block_t)];
+static uint8_t filled_queue_storage[(PULL_BLOCK_COUNT + 1) * sizeof(pull_block_t)];
+#endif
+static volatile esp_err_t writer_result = ESP_OK;
+
+static char manifest_buffer[PULL_MANIFEST_MAX];
+static char image_url[PULL_URL_MAX];
+
+// Response headers arrive here during esp_http_client_fetch_headers()
+static esp_err_t pull_event_handler(esp_http_client_event_t *evt)
+{
+    pull_stream_t *stream = (pull_stream_t *)evt->user_data;
+    if (evt->event_id != HTTP_EVENT_ON_HEADER || stream == NULL)
+    {
+        return ESP_OK;
+    }
+
+    if (strcasecmp(evt->header_key, "X-Firmware-SHA256") == 0)
+    {
+        snprintf(stream->firmware_sha256, sizeof(stream->firmware_sha256), "%s", evt->header_value);
+    }
+    else if (strcasecmp(evt->header_key, "X-Firmware-Length") == 0)
+    {
+        stream->firmware_length = strtoll(evt->header_value, NULL, 10);
+    }
+    else if (strcasecmp(evt->header_key, "Content-Range") == 0)
+    {
+        long long start;
+        stream->range_start = sscanf(evt->header_value, "bytes %lld-", &start) == 1 ? start : -1;
+    }
+    else if (strcasecmp(evt->header_key, "ETag") == 0)
+    {
+        // Weak or truncated tags cannot be used with If-Range
+        int len = snprintf(stream->etag, sizeof(stream->etag), "%s", evt->header_value);
+        if (len >= (int)sizeof(stream->etag) || strncmp(stream->etag, "W/", 2) == 0)
+        {
+            stream->etag[0] = '\0';
+        }
+    }
+    else if (strcasecmp(evt->header_key, "Last-Modified") == 0)
+    {
+        int len = snprintf(stream->last_modified, sizeof(stream->last_modified), "%s", evt->header_value);
+        if (len >= (int)sizeof(stream->last_modified))
+        {
+            stream->last_modified[0] = '\0';
+        }
+    }
+    return ESP_OK;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// 64 hex digits into a digest, false if hex is anything else
+static bool parse_sha256(const char *hex, uint8_t sha256[32])
+{
+    if (strlen(hex) != 64)
+    {
+        return false;
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        int hi = hex_nibble(hex[i * 2]);
+        int lo = hex_nibble(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        sha256[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+// (Re)open the stream at stream->offset, using a Range request when resuming. If-Range makes
+// a server whose file changed send the whole new file instead of splicing it onto the old one.
+static esp_err_t stream_open(pull_stream_t *stream)
+{
+    char range[32];
+
+    esp_http_client_close(stream->client);
+    stream->etag[0] = '\0';
+    stream->last_modified[0] = '\0';
+    stream->range_start = -1;
+    if (stream->offset > 0)
+    {
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned)stream->offset);
+        esp_http_client_set_header(stream->client, "Range", range);
+        if (stream->validator[0])
+        {
+            esp_http_client_set_header(stream->client, "If-Range", stream->validator);
+        }
+    }
+
+    esp_err_t err = esp_http_client_open(stream->client, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to connect to %s, error=%d", stream->url, err);
+        return err;
+    }
+
+    int64_t content_length = esp_http_client_fetch_headers(stream->client);
+    int status = esp_http_client_get_status_code(stream->client);
+    const char *validator = stream->etag[0] ? stream->etag : stream->last_modified;
+    if (stream->offset == 0)
+    {
+        snprintf(stream->validator, sizeof(stream->validator), "%s", validator);
+    }
+
+    if (status == 200)
+    {
+        if (stream->total < 0)
+        {
+            stream->total = content_length;
+        }
+
+        // A full response to If-Range means the file changed, what we have belongs to the old one
+        if (stream->offset > 0 && stream->validator[0] && strcmp(validator, stream->validator) != 0)
+        {
+            ESP_LOGE(TAG, "Source changed after %u bytes, cannot resume", (unsigned)stream->offset);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        // Server ignored the Range header, drop what we already have
+        size_t skip = stream->offset;
+        while (skip > 0)
+        {
+            char scratch[256];
+            int len = esp_http_client_read(stream->client, scratch, MIN(skip, sizeof(scratch)));
+            if (len <= 0)
+            {
+                return ESP_FAIL;
+            }
+            skip -= len;
+        }
+        return ESP_OK;
+    }
+
+    if (status == 206 && stream->offset > 0)
+    {
+        if (stream->range_start != (int64_t)stream->offset)
+        {
+            ESP_LOGE(TAG, "Resume asked for byte %u, server sent range from %lld", (unsigned)stream->offset,
+                     (long long)stream->range_start);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Server answered HTTP %d", status);
+    return ESP_ERR_INVALID_RESPONSE;
+}
+
+// Read up to len bytes, transparently resuming dropped connections. Returns 0 at end of image.
+static int stream_read(pull_stream_t *stream, uint8_t *buf, size_t len)
+{
+    size_t filled = 0;
+
+    while (filled < len)
+    {
+        int read = esp_http_client_read(stream->client, (char *)buf + filled, len - filled);
+        if (read > 0)
+        {
+            filled += read;
+            stream->offset += read;
+            continue;
+        }
+
+        if (read == 0 && esp_http_client_is_complete_data_received(stream->client))
+        {
+            break;
+        }
+
+        if (stream->resumes >= CONFIG_SIMPLE_OTA_PULL_RESUME_RETRIES)
+        {
+            ESP_LOGE(TAG, "Download interrupted after %u bytes, giving up", (unsigned)stream->offset);
+            return -1;
+        }
+        stream->resumes++;
+        ESP_LOGW(TAG, "Connection dropped at %u bytes, resuming (%d/%d)", (unsigned)stream->offset,
+                 stream->resumes, CONFIG_SIMPLE_OTA_PULL_RESUME_RETRIES);
+        if (stream_open(stream) != ESP_OK)
+        {
+            return -1;
+        }
+    }
+
+    return filled;
+}
+
+static void pull_writer_task(void *pvParameters)
+{
+    pull_block_t block;
+
+    while (xQueueReceive(filled_queue, &block, portMAX_DELAY) == pdTRUE && block.len > 0)
+    {
+        // After a failure keep draining so the downloader never blocks on a full queue
+        if (writer_result == ESP_OK)
+        {
+            writer_result = otaHandler_sessionWrite(pull_blocks[block.index], block.len);
+        }
+        xQueueSend(free_queue, &block, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(writer_done);
+    otaTask_exit();
+}
+
+static esp_err_t pipeline_create(void)
+{
+    if (free_queue == NULL)
+    {
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+        free_queue = xQueueCreateStatic(PULL_BLOCK_COUNT, sizeof(pull_block_t), free_queue_storage, &free_queue_buffer);
+        filled_queue = xQueueCreateStatic(PULL_BLOCK_COUNT + 1, sizeof(pull_block_t), filled_queue_storage, &filled_queue_buffer);
+        writer_done = xSemaphoreCreateBinaryStatic(&writer_done_buffer);
+#else
+        free_queue = xQueueCreate(PULL_BLOCK_COUNT, sizeof(pull_block_t));
+        filled_queue = xQueueCreate(PULL_BLOCK_COUNT + 1, sizeof(pull_block_t));
+        writer_done = xSemaphoreCreateBinary();
+#endif
+        if (free_queue == NULL || filled_queue == NULL || writer_done == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xQueueReset(free_queue);
+    xQueueReset(filled_queue);
+    for (uint8_t i = 0; i < PULL_BLOCK_COUNT; i++)
+    {
+        pull_block_t block = {.index = i, .len = 0};
+        xQueueSend(free_queue, &block, 0);
+    }
+    writer_result = ESP_OK;
+
+    return otaTask_create(pull_writer_task, "ota_pull_write", OTA_TASK_STACK_PULL_WRITER, NULL, OTA_TASK_PRIORITY_FLASH, NULL);
+}
+
+static esp_err_t pipeline_stream(pull_stream_t *stream, pull_block_t *first, otaPull_progress_cb_t progress_cb)
+{
+    pull_block_t block = *first;
+    esp_err_t err = ESP_OK;
+
+    while (block.len > 0)
+    {
+        xQueueSend(filled_queue, &block, portMAX_DELAY);
+
+        if (progress_cb)
+        {
+            progress_cb(stream->offset, stream->total > 0 ? (size_t)stream->total : 0);
+        }
+
+        xQueueReceive(free_queue, &block, portMAX_DELAY);
+        if (writer_result != ESP_OK)
+        {
+            err = writer_result;
+            break;
+        }
+
+        int len = stream_read(stream, pull_blocks[block.index], PULL_BLOCK_SIZE);
+        if (len < 0)
+        {
+            err = ESP_FAIL;
+            break;
+        }
+        block.len = len;
+    }
+
+    // Tell the writer we are done and wait until every queued block is on flash
+    pull_block_t end = {.index = 0, .len = 0};
+    xQueueSend(filled_queue, &end, portMAX_DELAY);
+    xSemaphoreTake(writer_done, portMAX_DELAY);
+
+    return err != ESP_OK ? err : writer_result;
+}
+
+// Pull url into the OTA session. expected holds a digest and size known in advance (from a
+// manifest), anything it leaves out is taken from the source's X-Firmware-* headers.
+static esp_err_t pull_image(const char *url, const otaHandler_preflight_t *expected, otaPull_progress_cb_t progress_cb)
+{
+    pull_stream_t stream = {
+        .url = url,
+        .offset = 0,
+        .total = -1,
+        .resumes = 0,
+        .firmware_length = -1};
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = CONFIG_SIMPLE_OTA_PULL_TIMEOUT_SECONDS * 1000,
+        .buffer_size = 1024,
+        .event_handler = pull_event_handler,
+        .user_data = &stream,
+    };
+    stream.client = esp_http_client_init(&config);
+
+    if (stream.client == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create HTTP client");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Pulling firmware from %s", url);
+
+    bool writer_started = false;
+    bool session_started = false;
+    esp_err_t err = pipeline_create();
+    if (err != ESP_OK)
+    {
+        goto cleanup;
+    }
+    writer_started = true;
+
+    err = stream_open(&stream);
+    if (err != ESP_OK)
+    {
+        goto cleanup;
+    }
+
+    // The pipeline is idle until the session starts, so block 0 is free for the header check
+    pull_block_t first;
+    xQueueReceive(free_queue, &first, portMAX_DELAY);
+    int len = stream_read(&stream, pull_blocks[first.index], PULL_BLOCK_SIZE);
+    if (len <= 0 || (size_t)len < MIN(OTA_HANDLER_HEADER_BYTES, PULL_BLOCK_SIZE))
+    {
+        ESP_LOGE(TAG, "No firmware data received");
+        xQueueSend(free_queue, &first, 0);
+        err = ESP_ERR_INVALID_SIZE;
+        goto cleanup;
+    }
+    first.len = len;
+
+    if (otaHandler_isRunningImage(pull_blocks[first.index], len))
+    {
+        ESP_LOGI(TAG, "Remote firmware is already running, nothing to do");
+        xQueueSend(free_queue, &first, 0);
+        err = OTA_PULL_ERR_UP_TO_DATE;
+        goto cleanup;
+    }
+
+    // Checked by sessionFinish, so a truncated or corrupted source never gets activated
+    otaHandler_preflight_t preflight = {0};
+    if (expected)
+    {
+        preflight = *expected;
+    }
+    if (!preflight.has_sha256)
+    {
+        preflight.has_sha256 = parse_sha256(stream.firmware_sha256, preflight.sha256);
+    }
+    if (preflight.expected_size == 0 && stream.firmware_length > 0)
+    {
+        preflight.expected_size = (size_t)stream.firmware_length;
+    }
+    ESP_LOGI(TAG, "Image %s digest, %s size", preflight.has_sha256 ? "with" : "without",
+             preflight.expected_size ? "known" : "unknown");
+
+    err = otaHandler_sessionBegin(&preflight);
+    if (err != ESP_OK)
+    {
+        xQueueSend(free_queue, &first, 0);
+        goto cleanup;
+    }
+    session_started = true;
+
+    // Same write path as an HTTP upload, the session validates and aborts on error
+    err = pipeline_stream(&stream, &first, progress_cb);
+    if (err != ESP_OK)
+    {
+        otaHandler_sessionAbort();
+        goto cleanup;
+    }
+
+    ESP_LOGI(TAG, "Downloaded %u bytes (%d resumes)", (unsigned)stream.offset, stream.resumes);
+    err = otaHandler_sessionFinish();
+
+cleanup:
+    if (writer_started && !session_started)
+    {
+        // Writer task is waiting for blocks that will never come
+        pull_block_t end = {.index = 0, .len = 0};
+        xQueueSend(filled_queue, &end, portMAX_DELAY);
+        xSemaphoreTake(writer_done, portMAX_DELAY);
+    }
+    esp_http_client_close(stream.client);
+    esp_http_client_cleanup(stream.client);
+    return err;
+}
+
+esp_err_t otaPull_fromUrl(const char *url, otaPull_progress_cb_t progress_cb)
+{
+    return pull_image(url, NULL, progress_cb);
+}
+
+// Fetch a small document into manifest_buffer
+static esp_err_t fetch_manifest(const char *url)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = CONFIG_SIMPLE_OTA_PULL_TIMEOUT_SECONDS * 1000,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err == ESP_OK)
+    {
+        esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        int filled = 0;
+        int len;
+        while (filled < PULL_MANIFEST_MAX - 1 &&
+               (len = esp_http_client_read(client, manifest_buffer + filled, PULL_MANIFEST_MAX - 1 - filled)) > 0)
+        {
+            filled += len;
+        }
+        manifest_buffer[filled] = '\0';
+
+        if (status != 200 || filled == 0)
+        {
+            ESP_LOGE(TAG, "Manifest request failed with HTTP %d", status);
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+// Image URLs in the manifest may be absolute, scheme-relative ("//host/..."),
+// root-relative ("/fw/app.bin") or relative to the manifest's directory
+static esp_err_t resolve_image_url(const char *manifest_url, const char *url)
+{
+    const char *scheme_end = strstr(manifest_url, "://");
+    int written;
+
+    if (strstr(url, "://") != NULL)
+    {
+        written = snprintf(image_url, sizeof(image_url), "%s", url);
+    }
+    else if (scheme_end == NULL)
+    {
+        ESP_LOGE(TAG, "Manifest URL %s has no scheme", manifest_url);
+        return ESP_ERR_INVALID_ARG;
+    }
+    else if (url[0] == '/' && url[1] == '/')
+    {
+        // Keep "http:" and take the host from the image URL
+        written = snprintf(image_url, sizeof(image_url), "%.*s%s", (int)(scheme_end + 1 - manifest_url), manifest_url, url);
+    }
+    else if (url[0] == '/')
+    {
+        // scheme://host[:port] of the manifest, then the path as given
+        const char *host = scheme_end + 3;
+        int origin_len = (int)(host + strcspn(host, "/?#") - manifest_url);
+        written = snprintf(image_url, sizeof(image_url), "%.*s%s", origin_len, manifest_url, url);
+    }
+    else
+    {
+        // Directory of the manifest, ignoring any query string
+        int path_len = (int)strcspn(manifest_url, "?#");
+        const char *last_slash = NULL;
+        for (const char *p = scheme_end + 3; p < manifest_url + path_len; p++)
+        {
+            if (*p == '/')
+            {
+                last_slash = p;
+            }
+        }
+        int base_len = last_slash ? (int)(last_slash - manifest_url) : path_len;
+        written = snprintf(image_url, sizeof(image_url), "%.*s/%s", base_len, manifest_url, url);
+    }
+
+    if (written < 0 || written >= (int)sizeof(image_url))
+    {
+        ESP_LOGE(TAG, "Image URL longer than %d characters", PULL_URL_MAX - 1);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t otaPull_fromManifest(const char *manifest_url, otaPull_progress_cb_t progress_cb)
+{
+    ESP_LOGI(TAG, "Checking manifest %s", manifest_url);
+
+    esp_err_t err = fetch_manifest(manifest_url);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    cJSON *manifest = cJSON_Parse(manifest_buffer);
+    if (manifest == NULL)
+    {
+        ESP_LOGE(TAG, "Manifest is not valid JSON");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    const cJSON *version = cJSON_GetObjectItemCaseSensitive(manifest, "version");
+    const cJSON *url = cJSON_GetObjectItemCaseSensitive(manifest, "url");
+    if (!cJSON_IsString(version) || !cJSON_IsString(url))
+    {
+        ESP_LOGE(TAG, "Manifest needs \"version\" and \"url\" strings");
+        cJSON_Delete(manifest);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    const esp_app_desc_t *running = esp_app_get_description();
+    if (strncmp(version->valuestring, running->version, sizeof(running->version)) == 0)
+    {
+        ESP_LOGI(TAG, "Running version %s matches manifest, skipping download", running->version);
+        cJSON_Delete(manifest);
+        return OTA_PULL_ERR_UP_TO_DATE;
+    }
+
+    // Optional, but a manifest from a trusted server is the best place to pin the image
+    otaHandler_preflight_t expected = {0};
+    const cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(manifest, "sha256");
+    const cJSON *size = cJSON_GetObjectItemCaseSensitive(manifest, "size");
+    if (sha256 != NULL && !(cJSON_IsString(sha256) && parse_sha256(sha256->valuestring, expected.sha256)))
+    {
+        ESP_LOGE(TAG, "Manifest \"sha256\" must be 64 hex digits");
+        cJSON_Delete(manifest);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    expected.has_sha256 = sha256 != NULL;
+    if (size != NULL && !(cJSON_IsNumber(size) && size->valuedouble > 0))
+    {
+        ESP_LOGE(TAG, "Manifest \"size\" must be a positive number");
+        cJSON_Delete(manifest);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    expected.expected_size = size ? (size_t)size->valuedouble : 0;
+
+    ESP_LOGI(TAG, "Manifest offers version %s (running %s)", version->valuestring, running->version);
+    err = resolve_image_url(manifest_url, url->valuestring);
+    cJSON_Delete(manifest);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    return pull_image(image_url, &expected, progress_cb);
+}
+
+#else
+
+esp_err_t otaPull_fromUrl(const char *url, otaPull_progress_cb_t progress_cb)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t otaPull_fromManifest(const char *manifest_url, otaPull_progress_cb_t progress_cb)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_SIMPLE_OTA_PULL
@@ -0,0 +1,197 @@
+#include "otaTask.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "OTA_TASK";
+
+// Smallest stack headroom seen at task exit, in bytes
+static size_t min_stack_headroom = SIZE_MAX;
+
+static void record_high_water(void)
+{
+    size_t headroom = uxTaskGetStackHighWaterMark(NULL);
+    ESP_LOGI(TAG, "Task %s exiting, %u bytes of stack never used", pcTaskGetName(NULL), (unsigned)headroom);
+    if (headroom < min_stack_headroom)
+    {
+        min_stack_headroom = headroom;
+    }
+}
+
+#if CONFIG_SIMPLE_OTA_STATIC_ALLOCATION
+// Stacks are carved from the arena the first time a task name needs one and never
+// returned, so the arena cannot fragment and its size is the worst-case budget
+typedef struct
+{
+    const char *name;
+    StaticTask_t tcb;
+    StackType_t *stack;
+    uint32_t stack_size;
+    TaskHandle_t handle;
+    volatile bool exited;
+    bool claimed;
+} task_slot_t;
+
+static StackType_t arena[OTA_TASK_STACK_BUDGET] __attribute__((aligned(16)));
+static size_t arena_used = 0;
+static task_slot_t slots[OTA_TASK_MAX_TASKS];
+static portMUX_TYPE slot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static task_slot_t *find_slot(TaskHandle_t handle)
+{
+    for (size_t i = 0; i < OTA_TASK_MAX_TASKS; i++)
+    {
+        if (slots[i].handle == handle && handle != NULL)
+        {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Reuse a finished slot with this name, or carve a new one. Returns NULL when the arena is full.
+static task_slot_t *claim_slot(const char *name, uint32_t stack_size, TaskHandle_t *finished)
+{
+    task_slot_t *slot = NULL;
+    *finished = NULL;
+
+    portENTER_CRITICAL(&slot_lock);
+    for (size_t i = 0; i < OTA_TASK_MAX_TASKS && !slot; i++)
+    {
+        task_slot_t *candidate = &slots[i];
+        if (candidate->name == NULL || candidate->claimed || strcmp(candidate->name, name) != 0 ||
+            candidate->stack_size < stack_size)
+        {
+            continue;
+        }
+        // An exited task is suspended, not yet deleted: it is safe to delete from here
+        if (candidate->handle == NULL ||
+            (candidate->exited && eTaskGetState(candidate->handle) == eSuspended))
+        {
+            slot = candidate;
+            *finished = candidate->handle;
+        }
+    }
+
+    for (size_t i = 0; i < OTA_TASK_MAX_TASKS && !slot; i++)
+    {
+        if (slots[i].name == NULL && arena_used + stack_size <= OTA_TASK_STACK_BUDGET)
+        {
+            slot = &slots[i];
+            slot->name = name;
+            slot->stack = &arena[arena_used];
+            slot->stack_size = stack_size;
+            arena_used += stack_size;
+        }
+    }
+
+    if (slot)
+    {
+        slot->claimed = true;
+        slot->exited = false;
+        slot->handle = NULL;
+    }
+    portEXIT_CRITICAL(&slot_lock);
+    return slot;
+}
+
+esp_err_t otaTask_create(TaskFunction_t task, const char *name, uint32_t stack_size,
+                         void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    TaskHandle_t finished;
+    task_slot_t *slot = claim_slot(name, stack_size, &finished);
+    if (!slot)
+    {
+        ESP_LOGE(TAG, "Static arena exhausted creating %s (%u of %u bytes used)",
+                 name, (unsigned)arena_used, (unsigned)OTA_TASK_STACK_BUDGET);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (finished)
+    {
+        vTaskDelete(finished);
+    }
+
+    slot->handle = xTaskCreateStaticPinnedToCore(task, name, slot->stack_size, param, priority,
+                                                 slot->stack, &slot->tcb, OTA_TASK_CORE);
+    slot->claimed = false;
+    if (handle)
+    {
+        *handle = slot->handle;
+    }
+    return ESP_OK;
+}
+
+void otaTask_exit(void)
+{
+    record_high_water();
+
+    task_slot_t *slot = find_slot(xTaskGetCurrentTaskHandle());
+    if (!slot)
+    {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    // Deleting ourselves would leave the TCB to the idle task; suspend and let the next create reclaim it
+    slot->exited = true;
+    vTaskSuspend(NULL);
+}
+
+void otaTask_delete(TaskHandle_t handle)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    task_slot_t *slot = find_slot(handle);
+    vTaskDelete(handle);
+    if (slot)
+    {
+        slot->handle = NULL;
+    }
+}
+
+void otaTask_getStats(otaTask_stats_t *stats)
+{
+    stats->arena_size = OTA_TASK_STACK_BUDGET;
+    stats->arena_used = arena_used;
+    stats->min_stack_headroom = min_stack_headroom == SIZE_MAX ? 0 : min_stack_headroom;
+}
+
+#else
+
+esp_err_t otaTask_create(TaskFunction_t task, const char *name, uint32_t stack_size,
+                         void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    BaseType_t result = xTaskCreatePinnedToCore(task, name, stack_size, param, priority, handle, OTA_TASK_CORE);
+    if (result != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create task %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void otaTask_exit(void)
+{
+    record_high_water();
+    vTaskDelete(NULL);
+}
+
+void otaTask_delete(TaskHandle_t handle)
+{
+    if (handle != NULL)
+    {
+        vTaskDelete(handle);
+    }
+}
+
+void otaTask_getStats(otaTask_stats_t *stats)
+{
+    stats->arena_size = 0;
+    stats->arena_used = 0;
+    stats->min_stack_headroom = min_stack_headroom == SIZE_MAX ? 0 : min_stack_headroom;
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include "otaTransfer.h"
+
+#if OTA_TRANSFER_ENABLED
+
+#include "otaHandler.h"
+#include "otaPull.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "OTA_TRANSFER";
+
+typedef struct
+{
+    bool started;      // START accepted, chunks expected
+    bool session_open; // Chunk 0 arrived and the OTA session began
+    bool force;
+    otaHandler_preflight_t preflight;
+    int64_t last_frame_us;
+    int last_progress;
+    bool has_result;
+    int32_t result_err;
+    uint8_t result_outcome;
+} transfer_t;
+
+static transfer_t transfer;
+static otaWindow_t window;
+static uint8_t window_buffer[CONFIG_SIMPLE_OTA_WINDOW_SLOTS * CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES];
+static simple_ota_event_cb_t event_cb = NULL;
+
+static void notify(simple_ota_status_t status, int progress, const char *message)
+{
+    if (event_cb)
+    {
+        event_cb(status, progress, message);
+    }
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t encode_result(uint8_t *reply, size_t cap, esp_err_t err, otaWindow_outcome_t outcome)
+{
+    uint8_t payload[5] = {
+        (uint8_t)err, (uint8_t)(err >> 8), (uint8_t)(err >> 16), (uint8_t)(err >> 24), (uint8_t)outcome};
+    return otaFrame_encode(reply, cap, OTA_FRAME_RESULT, 0, payload, sizeof(payload));
+}
+
+static size_t fail(uint8_t *reply, size_t cap, esp_err_t err, const char *message)
+{
+    ESP_LOGE(TAG, "%s: %s", message, esp_err_to_name(err));
+    otaTransfer_reset();
+    transfer.has_result = true;
+    transfer.result_err = err;
+    transfer.result_outcome = OTA_OUTCOME_FAILED;
+    notify(SIMPLE_OTA_FAILED, 0, message);
+    return encode_result(reply, cap, err, OTA_OUTCOME_FAILED);
+}
+
+// Late frames after a transfer ended get its result again, in case the first copy was lost
+static size_t repeat_result(uint8_t *reply, size_t cap)
+{
+    if (!transfer.has_result)
+    {
+        return encode_result(reply, cap, ESP_ERR_INVALID_STATE, OTA_OUTCOME_FAILED);
+    }
+    return encode_result(reply, cap, transfer.result_err, transfer.result_outcome);
+}
+
+// Window sink: chunks arrive here in order
+static esp_err_t write_chunk(uint32_t index, const uint8_t *data, size_t len, void *ctx)
+{
+    if (index == 0)
+    {
+        // Nothing is erased until the image has been identified
+        if (!transfer.force && otaHandler_isRunningImage(data, len))
+        {
+            ESP_LOGW(TAG, "Image is already running, send with force to reinstall");
+            return OTA_PULL_ERR_UP_TO_DATE;
+        }
+        esp_err_t err = otaHandler_sessionBegin(&transfer.preflight);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        transfer.session_open = true;
+    }
+
+    esp_err_t err = otaHandler_sessionWrite(data, len);
+    if (err != ESP_OK)
+    {
+        // The session aborted itself
+        transfer.session_open = false;
+        return err;
+    }
+
+    int progress = (int)(otaHandler_sessionWritten() * 100 / transfer.preflight.expected_size);
+    if (progress != transfer.last_progress)
+    {
+        transfer.last_progress = progress;
+        notify(SIMPLE_OTA_UPLOADING, progress, "Receiving firmware");
+    }
+    return ESP_OK;
+}
+
+static size_t handle_start(const otaFrame_t *frame, uint8_t *reply, size_t cap)
+{
+    if (transfer.started)
+    {
+        ESP_LOGW(TAG, "New transfer requested, abandoning the current one");
+        otaTransfer_reset();
+    }
+    transfer.has_result = false;
+
+    if (frame->length < OTA_START_PAYLOAD_BYTES)
+    {
+        return fail(reply, cap, ESP_ERR_INVALID_ARG, "Malformed start frame");
+    }
+
+    uint8_t flags = frame->payload[4];
+    memset(&transfer.preflight, 0, sizeof(transfer.preflight));
+    transfer.preflight.expected_size = read_u32(frame->payload);
+    transfer.preflight.has_sha256 = (flags & OTA_START_FLAG_SHA256) != 0;
+    memcpy(transfer.preflight.sha256, frame->payload + 6, sizeof(transfer.preflight.sha256));
+    transfer.force = (flags & OTA_START_FLAG_FORCE) != 0;
+
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (transfer.preflight.expected_size == 0 || !target || transfer.preflight.expected_size > target->size)
+    {
+        return fail(reply, cap, ESP_ERR_INVALID_SIZE, "Image does not fit the OTA partition");
+    }
+
+    otaWindow_init(&window, window_buffer, CONFIG_SIMPLE_OTA_WINDOW_SLOTS, CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES,
+                   write_chunk, NULL);
+    transfer.started = true;
+    transfer.last_progress = -1;
+    ESP_LOGI(TAG, "Receiving %u byte image in %u byte chunks, window of %u",
+             (unsigned)transfer.preflight.expected_size, CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES, CONFIG_SIMPLE_OTA_WINDOW_SLOTS);
+
+    uint8_t ready[4] = {
+        CONFIG_SIMPLE_OTA_WINDOW_SLOTS & 0xFF, CONFIG_SIMPLE_OTA_WINDOW_SLOTS >> 8,
+        CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES & 0xFF, CONFIG_SIMPLE_OTA_WINDOW_CHUNK_BYTES >> 8};
+    return otaFrame_encode(reply, cap, OTA_FRAME_READY, 0, ready, sizeof(ready));
+}
+
+static size_t handle_end(const otaFrame_t *frame, uint8_t *reply, size_t cap)
+{
+    // Chunks still missing: the ACK makes the host send them again
+    if (window.base < frame->seq)
+    {
+        return otaWindow_encodeAck(&window, reply, cap);
+    }
+    if (!transfer.session_open)
+    {
+        return fail(reply, cap, ESP_ERR_INVALID_SIZE, "No firmware data received");
+    }
+
+    transfer.started = false;
+    transfer.session_open = false;
+    esp_err_t err = otaHandler_sessionFinish();
+    if (err != ESP_OK)
+    {
+        return fail(reply, cap, err, "Firmware verification failed");
+    }
+
+    otaWindow_outcome_t outcome = OTA_OUTCOME_STAGED;
+    if (otaHandler_isAutoReboot())
+    {
+        // The reboot runs from a timer, the RESULT frame goes out first
+        err = otaHandler_activateStaged(OTA_HANDLER_REBOOT_FLUSH_MS);
+        if (err != ESP_OK)
+        {
+            return fail(reply, cap, err, "Boot partition update failed");
+        }
+        outcome = OTA_OUTCOME_ACTIVATED;
+    }
+
+    ESP_LOGI(TAG, "Transfer complete, %lu duplicate chunks", (unsigned long)window.duplicates);
+    transfer.has_result = true;
+    transfer.result_err = ESP_OK;
+    transfer.result_outcome = outcome;
+    notify(outcome == OTA_OUTCOME_ACTIVATED ? SIMPLE_OTA_SUCCESS : SIMPLE_OTA_STAGED, 100,
+           outcome == OTA_OUTCOME_ACTIVATED ? "Firmware received, rebooting" : "Firmware staged");
+    return encode_result(reply, cap, ESP_OK, outcome);
+}
+
+size_t otaTransfer_handleFrame(const otaFrame_t *frame, uint8_t *reply, size_t reply_cap)
+{
+    transfer.last_frame_us = esp_timer_get_time();
+
+    switch (frame->type)
+    {
+    case OTA_FRAME_START:
+        return handle_start(frame, reply, reply_cap);
+
+    case OTA_FRAME_DATA:
+    {
+        if (!transfer.started)
+        {
+            return repeat_result(reply, reply_cap);
+        }
+        esp_err_t err = otaWindow_receive(&window, frame->seq, frame->payload, frame->length);
+        if (err != ESP_OK)
+        {
+            return fail(reply, reply_cap, err, "Firmware write failed");
+        }
+        return otaWindow_encodeAck(&window, reply, reply_cap);
+    }
+
+    case OTA_FRAME_END:
+        if (!transfer.started)
+        {
+            return repeat_result(reply, reply_cap);
+        }
+        return handle_end(frame, reply, reply_cap);
+
+    case OTA_FRAME_ABORT:
+        if (transfer.started)
+        {
+            ESP_LOGW(TAG, "Host aborted the transfer");
+            otaTransfer_reset();
+            notify(SIMPLE_OTA_FAILED, 0, "Transfer aborted by host");
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+void otaTransfer_poll(void)
+{
+    if (transfer.started &&
+        esp_timer_get_time() - transfer.last_frame_us > (int64_t)OTA_TRANSFER_IDLE_TIMEOUT_MS * 1000)
+    {
+        ESP_LOGW(TAG, "No frames for %d ms, abandoning transfer", OTA_TRANSFER_IDLE_TIMEOUT_MS);
+        otaTransfer_reset();
+        notify(SIMPLE_OTA_FAILED, 0, "Transfer timed out");
+    }
+}
+
+void otaTransfer_reset(void)
+{
+    if (transfer.session_open)
+    {
+        otaHandler_sessionAbort();
+    }
+    transfer.started = false;
+    transfer.session_open = false;
+}
+
+void otaTransfer_setEventCallback(simple_ota_event_cb_t cb)
+{
+    event_cb = cb;
+}
+
+#endif // OTA_TRANSFER_ENABLED
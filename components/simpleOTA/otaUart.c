@@ -0,0 +1,176 @@
+#include "otaUart.h"
+#include "otaTransfer.h"
+
+#if CONFIG_SIMPLE_OTA_UART
+
+#include "otaTask.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+
+static const char *TAG = "OTA_UART";
+
+// A whole window (plus the START/END exchange) fits the driver buffer, so nothing is
+// dropped while the receiver is stalled in a flash erase
+#define OTA_UART_RX_BUFFER ((CONFIG_SIMPLE_OTA_WINDOW_SLOTS + 1) * OTA_TRANSFER_MAX_FRAME)
+#define OTA_UART_READ_BYTES 256
+#define OTA_UART_READ_TIMEOUT_MS 100
+
+static uint8_t frame_buffer[OTA_TRANSFER_MAX_FRAME];
+static uint8_t reply_buffer[64];
+static uint8_t read_buffer[OTA_UART_READ_BYTES];
+static otaFrame_parser_t parser;
+static TaskHandle_t uart_task_handle = NULL;
+static volatile bool uart_running = false;
+
+static void ota_uart_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Waiting for firmware on UART%d at %d baud", CONFIG_SIMPLE_OTA_UART_PORT, CONFIG_SIMPLE_OTA_UART_BAUD);
+
+    while (uart_running)
+    {
+        int received = uart_read_bytes(CONFIG_SIMPLE_OTA_UART_PORT, read_buffer, sizeof(read_buffer),
+                                       pdMS_TO_TICKS(OTA_UART_READ_TIMEOUT_MS));
+        if (received <= 0)
+        {
+            // An idle line ends any partial frame, it was corrupted
+            parser.fill = 0;
+        }
+
+        size_t offset = 0;
+        while (received > 0 && offset < (size_t)received)
+        {
+            otaFrame_t frame;
+            bool complete;
+            offset += otaFrame_parse(&parser, read_buffer + offset, received - offset, &frame, &complete);
+            if (!complete)
+            {
+                continue;
+            }
+
+            size_t reply_len = otaTransfer_handleFrame(&frame, reply_buffer, sizeof(reply_buffer));
+            if (reply_len > 0)
+            {
+                uart_write_bytes(CONFIG_SIMPLE_OTA_UART_PORT, reply_buffer, reply_len);
+            }
+        }
+        otaTransfer_poll();
+    }
+
+    otaTransfer_reset();
+    if (parser.crc_errors > 0)
+    {
+        ESP_LOGW(TAG, "%lu corrupt frames discarded", (unsigned long)parser.crc_errors);
+    }
+    uart_driver_delete(CONFIG_SIMPLE_OTA_UART_PORT);
+    ESP_LOGI(TAG, "Serial transport stopped");
+
+    uart_task_handle = NULL;
+    otaTask_exit();
+}
+
+esp_err_t otaUart_start(simple_ota_event_cb_t cb)
+{
+    if (uart_task_handle != NULL)
+    {
+        ESP_LOGW(TAG, "Serial transport already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const uart_config_t uart_config = {
+        .baud_rate = CONFIG_SIMPLE_OTA_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    // The port belongs to the application, never reconfigure or delete its driver
+    if (uart_is_driver_installed(CONFIG_SIMPLE_OTA_UART_PORT))
+    {
+        ESP_LOGE(TAG, "UART%d already has a driver installed, pick a free port", CONFIG_SIMPLE_OTA_UART_PORT);
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = uart_driver_install(CONFIG_SIMPLE_OTA_UART_PORT, OTA_UART_RX_BUFFER, 0, 0, NULL, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to install UART%d driver, error=%d", CONFIG_SIMPLE_OTA_UART_PORT, err);
+        return err;
+    }
+
+    // From here on the driver is ours to delete
+    err = uart_param_config(CONFIG_SIMPLE_OTA_UART_PORT, &uart_config);
+    if (err == ESP_OK)
+    {
+        err = uart_set_pin(CONFIG_SIMPLE_OTA_UART_PORT, CONFIG_SIMPLE_OTA_UART_TX_PIN, CONFIG_SIMPLE_OTA_UART_RX_PIN,
+                           UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set up UART%d, error=%d", CONFIG_SIMPLE_OTA_UART_PORT, err);
+        uart_driver_delete(CONFIG_SIMPLE_OTA_UART_PORT);
+        return err;
+    }
+
+    otaFrame_parserInit(&parser, frame_buffer, sizeof(frame_buffer));
+    otaTransfer_setEventCallback(cb);
+    uart_running = true;
+
+    err = otaTask_create(
+        ota_uart_task,
+        "ota_uart",
+        OTA_TASK_STACK_UART,
+        NULL, // Parameters
+        OTA_TASK_PRIORITY_NET,
+        &uart_task_handle);
+
+    if (err != ESP_OK)
+    {
+        uart_running = false;
+        uart_task_handle = NULL;
+        uart_driver_delete(CONFIG_SIMPLE_OTA_UART_PORT);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void otaUart_stop(void)
+{
+    if (uart_task_handle == NULL)
+    {
+        return;
+    }
+
+    uart_running = false;
+
+    // The task notices within one read timeout and clears its handle on exit
+    for (int i = 0; i < 20 && uart_task_handle != NULL; i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(OTA_UART_READ_TIMEOUT_MS));
+    }
+}
+
+bool otaUart_isRunning(void)
+{
+    return uart_running;
+}
+
+#else
+
+esp_err_t otaUart_start(simple_ota_event_cb_t cb)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void otaUart_stop(void)
+{
+}
+
+bool otaUart_isRunning(void)
+{
+    return false;
+}
+
+#endif // CONFIG_SIMPLE_OTA_UART
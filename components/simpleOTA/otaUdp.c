@@ -0,0 +1,158 @@
+#include "otaUdp.h"
+#include "otaTransfer.h"
+
+#if CONFIG_SIMPLE_OTA_UDP
+
+#include "otaTask.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "esp_log.h"
+
+static const char *TAG = "OTA_UDP";
+
+#define OTA_UDP_RECEIVE_TIMEOUT_MS 100
+
+static uint8_t datagram[OTA_TRANSFER_MAX_FRAME];
+static uint8_t reply_buffer[64];
+static TaskHandle_t udp_task_handle = NULL;
+static volatile bool udp_running = false;
+
+static void ota_udp_task(void *pvParameters)
+{
+    uint32_t rejected = 0;
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        goto exit;
+    }
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Short timeout: otaTransfer_poll() runs between datagrams and otaUdp_stop() waits on it
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = OTA_UDP_RECEIVE_TIMEOUT_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in bind_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(OTA_UDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY)};
+
+    if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0)
+    {
+        ESP_LOGE(TAG, "Failed to bind port %d: errno %d", OTA_UDP_PORT, errno);
+        close(sock);
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Waiting for firmware on UDP port %d", OTA_UDP_PORT);
+
+    while (udp_running)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int received = recvfrom(sock, datagram, sizeof(datagram), 0,
+                                (struct sockaddr *)&client_addr, &addr_len);
+        if (received > 0)
+        {
+            // A datagram is a whole frame; anything else is dropped and the window retransmits it
+            otaFrame_t frame;
+            if (!otaFrame_decode(datagram, (size_t)received, &frame))
+            {
+                rejected++;
+            }
+            else
+            {
+                size_t reply_len = otaTransfer_handleFrame(&frame, reply_buffer, sizeof(reply_buffer));
+                if (reply_len > 0)
+                {
+                    sendto(sock, reply_buffer, reply_len, 0, (struct sockaddr *)&client_addr, addr_len);
+                }
+            }
+        }
+        otaTransfer_poll();
+    }
+
+    close(sock);
+    otaTransfer_reset();
+    if (rejected > 0)
+    {
+        ESP_LOGW(TAG, "%lu malformed datagrams discarded", (unsigned long)rejected);
+    }
+    ESP_LOGI(TAG, "UDP transport stopped");
+
+exit:
+    udp_running = false;
+    udp_task_handle = NULL;
+    otaTask_exit();
+}
+
+esp_err_t otaUdp_start(simple_ota_event_cb_t cb)
+{
+    if (udp_task_handle != NULL)
+    {
+        ESP_LOGW(TAG, "UDP transport already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    otaTransfer_setEventCallback(cb);
+    udp_running = true;
+
+    esp_err_t err = otaTask_create(
+        ota_udp_task,
+        "ota_udp",
+        OTA_TASK_STACK_UDP,
+        NULL, // Parameters
+        OTA_TASK_PRIORITY_NET,
+        &udp_task_handle);
+
+    if (err != ESP_OK)
+    {
+        udp_running = false;
+        udp_task_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void otaUdp_stop(void)
+{
+    if (udp_task_handle == NULL)
+    {
+        return;
+    }
+
+    udp_running = false;
+
+    // The task notices within one receive timeout and clears its handle on exit
+    for (int i = 0; i < 20 && udp_task_handle != NULL; i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(OTA_UDP_RECEIVE_TIMEOUT_MS));
+    }
+}
+
+bool otaUdp_isRunning(void)
+{
+    return udp_running;
+}
+
+#else
+
+esp_err_t otaUdp_start(simple_ota_event_cb_t cb)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void otaUdp_stop(void)
+{
+}
+
+bool otaUdp_isRunning(void)
+{
+    return false;
+}
+
+#endif // CONFIG_SIMPLE_OTA_UDP
@@ -0,0 +1,197 @@
+#include "otaWindow.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+static uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void write_u32(uint8_t *p, uint32_t value)
+{
+    write_u16(p, value & 0xFFFF);
+    write_u16(p + 2, value >> 16);
+}
+
+size_t otaFrame_encode(uint8_t *out, size_t cap, uint8_t type, uint32_t seq, const uint8_t *payload, uint16_t length)
+{
+    size_t total = (size_t)length + OTA_FRAME_OVERHEAD;
+    if (total > cap || length > OTA_FRAME_MAX_PAYLOAD)
+    {
+        return 0;
+    }
+
+    out[0] = OTA_FRAME_SYNC0;
+    out[1] = OTA_FRAME_SYNC1;
+    out[2] = type;
+    out[3] = 0;
+    write_u32(out + 4, seq);
+    write_u16(out + 8, length);
+    if (length > 0)
+    {
+        memcpy(out + OTA_FRAME_HEADER_BYTES, payload, length);
+    }
+    write_u32(out + OTA_FRAME_HEADER_BYTES + length, esp_rom_crc32_le(0, out + 2, OTA_FRAME_HEADER_BYTES - 2 + length));
+    return total;
+}
+
+bool otaFrame_decode(const uint8_t *data, size_t len, otaFrame_t *frame)
+{
+    if (len < OTA_FRAME_OVERHEAD || data[0] != OTA_FRAME_SYNC0 || data[1] != OTA_FRAME_SYNC1)
+    {
+        return false;
+    }
+
+    uint16_t length = read_u16(data + 8);
+    if (len != (size_t)length + OTA_FRAME_OVERHEAD)
+    {
+        return false;
+    }
+    if (esp_rom_crc32_le(0, data + 2, OTA_FRAME_HEADER_BYTES - 2 + length) != read_u32(data + OTA_FRAME_HEADER_BYTES + length))
+    {
+        return false;
+    }
+
+    frame->type = data[2];
+    frame->flags = data[3];
+    frame->seq = read_u32(data + 4);
+    frame->length = length;
+    frame->payload = data + OTA_FRAME_HEADER_BYTES;
+    return true;
+}
+
+void otaFrame_parserInit(otaFrame_parser_t *parser, uint8_t *buffer, size_t capacity)
+{
+    parser->buffer = buffer;
+    parser->capacity = capacity;
+    parser->fill = 0;
+    parser->crc_errors = 0;
+}
+
+size_t otaFrame_parse(otaFrame_parser_t *parser, const uint8_t *data, size_t len, otaFrame_t *frame, bool *complete)
+{
+    size_t used = 0;
+    *complete = false;
+
+    while (used < len)
+    {
+        uint8_t byte = data[used++];
+
+        // Hunt for the sync pair, everything before it is line noise
+        if (parser->fill == 0 && byte != OTA_FRAME_SYNC0)
+        {
+            continue;
+        }
+        if (parser->fill == 1 && byte != OTA_FRAME_SYNC1)
+        {
+            parser->fill = byte == OTA_FRAME_SYNC0 ? 1 : 0;
+            continue;
+        }
+        parser->buffer[parser->fill++] = byte;
+        if (parser->fill < OTA_FRAME_HEADER_BYTES)
+        {
+            continue;
+        }
+
+        size_t total = (size_t)read_u16(parser->buffer + 8) + OTA_FRAME_OVERHEAD;
+        if (total > parser->capacity || total > OTA_FRAME_MAX_PAYLOAD + OTA_FRAME_OVERHEAD)
+        {
+            // Corrupt length, drop it and hunt again; the sender retransmits whatever was lost
+            parser->crc_errors++;
+            parser->fill = 0;
+            continue;
+        }
+        if (parser->fill < total)
+        {
+            continue;
+        }
+
+        parser->fill = 0;
+        if (otaFrame_decode(parser->buffer, total, frame))
+        {
+            *complete = true;
+            return used;
+        }
+        parser->crc_errors++;
+    }
+    return used;
+}
+
+void otaWindow_init(otaWindow_t *window, uint8_t *buffer, uint16_t slots, uint16_t chunk_bytes,
+                    otaWindow_sink_t sink, void *ctx)
+{
+    memset(window, 0, sizeof(*window));
+    window->buffer = buffer;
+    window->slots = slots > OTA_WINDOW_MAX_SLOTS ? OTA_WINDOW_MAX_SLOTS : slots;
+    window->chunk_bytes = chunk_bytes;
+    window->sink = sink;
+    window->ctx = ctx;
+}
+
+esp_err_t otaWindow_receive(otaWindow_t *window, uint32_t seq, const uint8_t *data, size_t len)
+{
+    if (seq < window->base || len > window->chunk_bytes)
+    {
+        window->duplicates++;
+        return ESP_OK;
+    }
+
+    uint32_t offset = seq - window->base;
+    if (offset >= window->slots || (window->held & (1u << offset)))
+    {
+        window->duplicates++;
+        return ESP_OK;
+    }
+
+    // In-order chunk with nothing waiting behind it goes straight to the sink, no copy
+    if (offset == 0)
+    {
+        esp_err_t err = window->sink(seq, data, len, window->ctx);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        window->base++;
+        window->held >>= 1;
+    }
+    else
+    {
+        uint16_t slot = seq % window->slots;
+        memcpy(window->buffer + (size_t)slot * window->chunk_bytes, data, len);
+        window->lengths[slot] = len;
+        window->held |= 1u << offset;
+    }
+
+    // Release whatever the new chunk made contiguous
+    while (window->held & 1)
+    {
+        uint16_t slot = window->base % window->slots;
+        esp_err_t err = window->sink(window->base, window->buffer + (size_t)slot * window->chunk_bytes,
+                                     window->lengths[slot], window->ctx);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        window->base++;
+        window->held >>= 1;
+    }
+    return ESP_OK;
+}
+
+size_t otaWindow_encodeAck(const otaWindow_t *window, uint8_t *out, size_t cap)
+{
+    uint8_t sack[4];
+    write_u32(sack, window->held >> 1);
+    return otaFrame_encode(out, cap, OTA_FRAME_ACK, window->base, sack, sizeof(sack));
+}
@@ -1,6 +1,11 @@
 #include "simpleOTA.h"
 #include "apUpdate.h"
 #include "otaHandler.h"
+#include "healthCheck.h"
+#include "otaPull.h"
+#include "otaTask.h"
+#include "otaUart.h"
+#include "otaUdp.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -11,11 +16,119 @@ static simple_ota_status_t current_status = SIMPLE_OTA_IDLE;
 static simple_ota_event_cb_t event_callback = NULL;
 static bool ota_initialised = false;
 
+static void pull_progress(size_t received, size_t total)
+{
+    static int last_progress = -1;
+    int progress = total ? (int)((received * 100) / total) : 0;
+
+    current_status = SIMPLE_OTA_DOWNLOADING;
+    if (event_callback && progress != last_progress) {
+        last_progress = progress;
+        event_callback(current_status, progress, "Downloading firmware");
+    }
+}
+
+// Pull modes: join sta_ssid and fetch new firmware, returns only if nothing was installed
+static esp_err_t simple_ota_pull(simple_ota_config_t* config)
+{
+#if !CONFIG_SIMPLE_OTA_PULL
+    ESP_LOGE(TAG, "Pull modes are not built, enable Update Mode -> Pull firmware over Wi-Fi");
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    ESP_LOGI(TAG, "Pull mode: joining %s", config->sta_ssid);
+
+    esp_err_t err = apUpdate_startSta(config->sta_ssid, config->sta_password,
+                                      CONFIG_SIMPLE_OTA_PULL_TIMEOUT_SECONDS * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "Pull source network not reachable");
+        return err;
+    }
+
+    if (config->mode == SIMPLE_OTA_MODE_STA_PULL) {
+        err = otaPull_fromManifest(config->manifest_url, pull_progress);
+    } else {
+        err = otaPull_fromUrl(config->pull_url, pull_progress);
+    }
+    apUpdate_stopSta();
+
+    if (err == OTA_PULL_ERR_UP_TO_DATE) {
+        ESP_LOGI(TAG, "Already running the offered firmware");
+        return err;
+    }
+
+    if (err == ESP_OK && config->auto_reboot) {
+        err = otaHandler_activateStaged(OTA_HANDLER_REBOOT_FLUSH_MS);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Firmware pull failed: %s", esp_err_to_name(err));
+        current_status = SIMPLE_OTA_FAILED;
+        if (event_callback) {
+            event_callback(current_status, 0, "Firmware pull failed");
+        }
+        return err;
+    }
+
+    current_status = config->auto_reboot ? SIMPLE_OTA_SUCCESS : SIMPLE_OTA_STAGED;
+    if (event_callback) {
+        event_callback(current_status, 100, config->auto_reboot ? "Firmware pulled, rebooting" : "Firmware staged");
+    }
+    return ESP_OK;
+#endif
+}
+
+// Transfers over the serial and UDP transports report here
+static void transfer_event(simple_ota_status_t status, int progress, const char* message)
+{
+    current_status = status;
+    if (event_callback) {
+        event_callback(status, progress, message);
+    }
+}
+
 // Internal task to manage OTA lifecycle
 static void simple_ota_task(void* pvParameters)
 {
     simple_ota_config_t* config = (simple_ota_config_t*)pvParameters;
     
+    // Updated devices fall through to AP mode and serve their image to the next neighbour,
+    // the staged one when auto_reboot is off (see firmware_slot_from_query in otaHandler.c)
+    if (config->mode == SIMPLE_OTA_MODE_MIRROR_PULL) {
+        if (simple_ota_pull(config) == ESP_OK && config->auto_reboot) {
+            // Reboot is already scheduled, no point serving the old image until then
+            otaTask_exit();
+            return;
+        }
+    }
+
+    // Wi-Fi stays off, the UART task runs until simpleOTA_stop()
+    if (config->mode == SIMPLE_OTA_MODE_SERIAL) {
+        esp_err_t err = otaUart_start(transfer_event);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Serial transport failed to start: %s", esp_err_to_name(err));
+            current_status = SIMPLE_OTA_FAILED;
+            ota_initialised = false;
+        } else {
+            current_status = SIMPLE_OTA_SERIAL_STARTED;
+        }
+        if (event_callback) {
+            event_callback(current_status, 0, err == ESP_OK ? "Serial transport started" : "Serial transport failed");
+        }
+        otaTask_exit();
+        return;
+    }
+
+    // Site Wi-Fi pull is a one-shot check, the application decides when to call it again
+    if (config->mode == SIMPLE_OTA_MODE_STA_PULL) {
+        // STAGED / SUCCESS / FAILED stay visible in simpleOTA_getStatus(), nothing to do is IDLE
+        if (simple_ota_pull(config) == OTA_PULL_ERR_UP_TO_DATE) {
+            current_status = SIMPLE_OTA_IDLE;
+        }
+        ota_initialised = false;
+        otaTask_exit();
+        return;
+    }
+
     ESP_LOGI(TAG, "Starting Simple OTA with SSID: %s", config->ap_ssid);
     
     // Update status
@@ -24,13 +137,17 @@ static void simple_ota_task(void* pvParameters)
         event_callback(current_status, 0, "Access Point started");
     }
     
-    apUpdate_task(NULL);
-    
-    while (current_status != SIMPLE_OTA_IDLE) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    apUpdate_start();
+
+#if CONFIG_SIMPLE_OTA_UDP
+    // Runs beside the web server, apUpdate_stop() shuts it down with the AP
+    if (otaUdp_start(transfer_event) != ESP_OK) {
+        ESP_LOGW(TAG, "UDP transport failed to start, web uploads still available");
     }
-    
-    vTaskDelete(NULL);
+#endif
+
+    // The web server, DNS and UDP tasks carry on, this one is done
+    otaTask_exit();
 }
 
 esp_err_t simpleOTA_start(void)
@@ -54,6 +171,7 @@ esp_err_t simpleOTA_startWithConfig(const simple_ota_config_t* config)
     
     // Copy configuration
     current_config = *config;
+    otaHandler_setAutoReboot(current_config.auto_reboot);
     ota_initialised = true;
     current_status = SIMPLE_OTA_IDLE;
     
@@ -63,16 +181,16 @@ esp_err_t simpleOTA_startWithConfig(const simple_ota_config_t* config)
     ESP_LOGI(TAG, "Timeout: %d minutes", current_config.timeout_minutes);
     
     // Create OTA task
-    BaseType_t result = xTaskCreate(
+    esp_err_t result = otaTask_create(
         simple_ota_task,
         "simple_ota_task",
-        8192,  // Stack size
+        OTA_TASK_STACK_MAIN,
         &current_config,
-        5,     // Priority
+        OTA_TASK_PRIORITY_NET,
         NULL
     );
     
-    if (result != pdPASS) {
+    if (result != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create Simple OTA task");
         ota_initialised = false;
         return ESP_ERR_NO_MEM;
@@ -91,7 +209,11 @@ esp_err_t simpleOTA_stop(void)
     ESP_LOGI(TAG, "Stopping Simple OTA");
     
     // Stop the AP update service
-    apUpdate_stop();
+    if (current_config.mode == SIMPLE_OTA_MODE_SERIAL) {
+        otaUart_stop();
+    } else {
+        apUpdate_stop();
+    }
     
     current_status = SIMPLE_OTA_IDLE;
     ota_initialised = false;
@@ -129,10 +251,91 @@ const char* simpleOTA_getApIp(void)
     return NULL;
 }
 
+int64_t simpleOTA_getPortalLatencyMs(void)
+{
+    return apUpdate_getPortalLatencyMs();
+}
+
+int64_t simpleOTA_getWorstFlashStallUs(void)
+{
+    return otaHandler_getWorstFlashStallUs();
+}
+
+bool simpleOTA_hasStagedUpdate(void)
+{
+    return otaHandler_hasStagedUpdate();
+}
+
+esp_err_t simpleOTA_activateStaged(uint32_t delay_ms)
+{
+    esp_err_t err = otaHandler_activateStaged(delay_ms);
+    if (err == ESP_OK) {
+        current_status = SIMPLE_OTA_SUCCESS;
+        if (event_callback) {
+            event_callback(current_status, 100, "Staged firmware activated");
+        }
+    }
+    return err;
+}
+
+esp_err_t simpleOTA_setRebootCheck(simple_ota_reboot_check_cb_t callback)
+{
+    otaHandler_setRebootCheck(callback);
+    return ESP_OK;
+}
+
+esp_err_t simpleOTA_listSlots(simple_ota_slot_info_t* slots, size_t max_slots, size_t* count)
+{
+    if (!count || (max_slots > 0 && !slots)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return otaHandler_listSlots(slots, max_slots, count);
+}
+
+esp_err_t simpleOTA_switchToSlot(const char* label, uint32_t delay_ms)
+{
+    const esp_partition_t* partition = label
+        ? esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, label)
+        : esp_ota_get_next_update_partition(NULL);
+    if (!partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return otaHandler_switchToSlot(partition, delay_ms);
+}
+
+esp_err_t simpleOTA_getMemoryBudget(simple_ota_memory_t* memory)
+{
+    if (!memory) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    otaTask_stats_t stats;
+    otaTask_getStats(&stats);
+    memory->static_budget = stats.arena_size;
+    memory->static_used = stats.arena_used;
+    memory->min_stack_headroom = stats.min_stack_headroom;
+    return ESP_OK;
+}
+
 esp_err_t simpleOTA_validateOnBoot(void)
 {
     ESP_LOGI(TAG, "Validating OTA update on boot");
-    otaHandler_validateUpdate();
+    healthCheck_validateBoot();
     return ESP_OK;
 }
 
+esp_err_t simpleOTA_registerHealthCheck(const char* name, simple_ota_health_check_fn_t check, void* arg, uint32_t timeout_ms)
+{
+    return healthCheck_register(name, check, arg, timeout_ms);
+}
+
+bool simpleOTA_isValidationPending(void)
+{
+    return healthCheck_isPending();
+}
+
+int64_t simpleOTA_getBootToValidMs(void)
+{
+    return healthCheck_getBootToValidMs();
+}
+
@@ -1,4 +1,91 @@
 let currentFile = null;
+let deviceInfo = null;
+let currentImageInfo = null;
+
+// Image layout: 24-byte image header, 8-byte segment header, then esp_app_desc_t
+const IMAGE_HEADER_MAGIC = 0xE9;
+const APP_DESC_OFFSET = 32;
+const APP_DESC_MAGIC = 0xABCD5432;
+const IMAGE_INFO_BYTES = APP_DESC_OFFSET + 256;
+
+function loadDeviceInfo() {
+  const xhr = new XMLHttpRequest();
+  xhr.open('GET', '/info', true);
+  xhr.onload = function() {
+    if (xhr.status === 200) {
+      try {
+        deviceInfo = JSON.parse(xhr.responseText);
+      } catch (e) {
+        console.error('Invalid /info response', e);
+      }
+    }
+  };
+  xhr.send();
+}
+
+function readCString(bytes, offset, length) {
+  let str = '';
+  for (let i = offset; i < offset + length && bytes[i] !== 0; i++) {
+    str += String.fromCharCode(bytes[i]);
+  }
+  return str;
+}
+
+function toHex(bytes) {
+  return Array.prototype.map.call(bytes, function(b) {
+    return ('0' + b.toString(16)).slice(-2);
+  }).join('');
+}
+
+// Read chip id and app descriptor from the start of a .bin, null if it is not an app image
+function readImageInfo(file, callback) {
+  const reader = new FileReader();
+  reader.onload = function() {
+    const bytes = new Uint8Array(reader.result);
+    if (bytes.length < IMAGE_INFO_BYTES || bytes[0] !== IMAGE_HEADER_MAGIC) {
+      callback(null);
+      return;
+    }
+    const view = new DataView(reader.result);
+    if (view.getUint32(APP_DESC_OFFSET, true) !== APP_DESC_MAGIC) {
+      callback(null);
+      return;
+    }
+    callback({
+      chipId: view.getUint16(12, true),
+      version: readCString(bytes, APP_DESC_OFFSET + 16, 32),
+      project: readCString(bytes, APP_DESC_OFFSET + 48, 32),
+      idf: readCString(bytes, APP_DESC_OFFSET + 112, 32),
+      elfSha256: toHex(bytes.subarray(APP_DESC_OFFSET + 144, APP_DESC_OFFSET + 176))
+    });
+  };
+  reader.onerror = function() {
+    callback(null);
+  };
+  reader.readAsArrayBuffer(file.slice(0, IMAGE_INFO_BYTES));
+}
+
+// Compare the selected image against the running firmware
+function checkImageAgainstDevice(info) {
+  const result = { errors: [], warnings: [], identical: false };
+  if (!info) {
+    result.errors.push('File is not an ESP-IDF application image');
+    return result;
+  }
+  if (!deviceInfo) {
+    return result;
+  }
+  if (info.chipId !== deviceInfo.chip.chip_id) {
+    result.errors.push('Image is built for a different chip (device is ' + deviceInfo.chip.target + ')');
+  }
+  if (info.elfSha256 === deviceInfo.app.elf_sha256) {
+    result.identical = true;
+  }
+  if (info.project !== deviceInfo.app.project) {
+    result.warnings.push('Project "' + info.project + '" differs from running "' + deviceInfo.app.project + '"');
+  }
+  return result;
+}
 
 function setupDragDrop() {
   const dragDropArea = document.getElementById('dragDropArea');
@@ -41,6 +128,18 @@ function setupDragDrop() {
 }
 
 function updateFileDisplay(file) {
+  currentImageInfo = null;
+  readImageInfo(file, function(info) {
+    currentImageInfo = info;
+    if (info && file === currentFile) {
+      const versionElem = document.getElementById('imageVersion');
+      if (versionElem) {
+        versionElem.innerHTML = '<strong>Version:</strong> ' + info.version +
+          (deviceInfo ? ' (running ' + deviceInfo.app.version + ')' : '');
+      }
+    }
+  });
+
   const fileSize = (file.size / 1024 / 1024).toFixed(2);
   document.getElementById('dragDropArea').innerHTML = 
     '<div class="upload-icon">' +
@@ -50,6 +149,7 @@ function updateFileDisplay(file) {
     '</div>' +
     '<p><strong>Selected:</strong> ' + file.name + '</p>' +
     '<p><strong>Size:</strong> ' + fileSize + ' MB</p>' +
+    '<p id="imageVersion"></p>' +
     '<p>Click Upload Firmware to proceed</p>';
   document.getElementById('uploadButton').disabled = false;
 }
@@ -86,6 +186,8 @@ function getDetailedErrorMessage(status, responseText) {
   switch (status) {
     case 400:
       return serverMessage || 'Invalid firmware file';
+    case 409:
+      return serverMessage || 'Firmware already installed';
     case 413:
       const maxSizeMB = typeof CONFIG_MAX_FILE_SIZE_MB !== 'undefined' ? CONFIG_MAX_FILE_SIZE_MB : 2;
       return 'File too large (max ' + maxSizeMB + 'MB)';
@@ -139,9 +241,6 @@ function uploadFirmware(event) {
   if (event) event.preventDefault();
   
   const fileInput = document.querySelector('input[type="file"]');
-  const submitButton = document.querySelector('.btn-primary');
-  const progressContainer = document.querySelector('.progress-container');
-  const progressFill = document.querySelector('.progress-fill');
   const file = currentFile || fileInput.files[0];
   
   // Validate file before upload
@@ -156,15 +255,105 @@ function uploadFirmware(event) {
     return;
   }
   
-  if (!confirm(
-    'Are you sure you want to update the firmware?\n\n' +
-    'File: ' + file.name + '\n' +
-    'Size: ' + (file.size / 1024 / 1024).toFixed(2) + ' MB\n\n' +
-    'The device will restart after successful update.'
-  )) {
+  runPreflight(file, function(preflight) {
+    if (preflight.error) {
+      showStatus('<strong>Incompatible Firmware</strong><br>' + preflight.error, 'error');
+      return;
+    }
+    const info = preflight.info;
+    const check = checkImageAgainstDevice(info);
+    if (check.errors.length > 0) {
+      showStatus(
+        '<strong>Incompatible Firmware</strong><br>' +
+        check.errors.join('<br>'),
+        'error'
+      );
+      return;
+    }
+    
+    let force = false;
+    if (check.identical) {
+      if (!confirm(
+        'The device is already running this firmware (' + info.version + ').\n\n' +
+        'Upload and reinstall it anyway?'
+      )) {
+        showStatus('Upload skipped - device already runs this firmware', 'success');
+        return;
+      }
+      force = true;
+    }
+    
+    if (!confirm(
+      'Are you sure you want to update the firmware?\n\n' +
+      'File: ' + file.name + '\n' +
+      'Size: ' + (file.size / 1024 / 1024).toFixed(2) + ' MB\n' +
+      (info ? 'Version: ' + info.version + '\n' : '') +
+      (check.warnings.length > 0 ? '\nWarning: ' + check.warnings.join('\nWarning: ') + '\n' : '') +
+      (deviceAutoReboot()
+        ? '\nThe device will restart after successful update.'
+        : '\nThe firmware will be staged. Activate it afterwards to restart into it.')
+    )) {
+      return;
+    }
+    
+    sendFirmware(file, force, preflight);
+  });
+}
+
+// Parse, chip-check and hash the image in a Web Worker before any byte goes over the air
+function runPreflight(file, callback) {
+  if (!window.Worker) {
+    readImageInfo(file, function(info) {
+      callback({ info: info, sha256: null, slices: null });
+    });
     return;
   }
   
+  const worker = new Worker('/preflight.js');
+  worker.onmessage = function(e) {
+    const msg = e.data;
+    if (msg.type === 'progress') {
+      showStatus('<span class="spinner"></span>Checking firmware... ' + msg.percent.toFixed(0) + '%');
+      return;
+    }
+    worker.terminate();
+    showStatus('');
+    if (msg.type === 'error') {
+      callback({ error: msg.message });
+    } else {
+      callback({ info: msg.info, sha256: msg.sha256, slices: msg.slices });
+    }
+  };
+  worker.onerror = function(e) {
+    // Fall back to the main-thread header check if the worker cannot run
+    console.error('Pre-flight worker failed', e);
+    worker.terminate();
+    readImageInfo(file, function(info) {
+      callback({ info: info, sha256: null, slices: null });
+    });
+  };
+  worker.postMessage({
+    file: file,
+    chipId: deviceInfo ? deviceInfo.chip.chip_id : undefined,
+    sliceSize: 64 * 1024
+  });
+}
+
+// Sequence number of the slice the upload has reached
+function currentSlice(slices, loaded) {
+  for (let i = 0; i < slices.length; i++) {
+    if (loaded < slices[i].offset + slices[i].length) {
+      return slices[i].seq + 1;
+    }
+  }
+  return slices.length;
+}
+
+function sendFirmware(file, force, preflight) {
+  const submitButton = document.querySelector('.btn-primary');
+  const progressContainer = document.querySelector('.progress-container');
+  const progressFill = document.querySelector('.progress-fill');
+  
   // Hide upload button and show progress bar
   submitButton.style.display = 'none';
   progressContainer.style.display = 'block';
@@ -174,15 +363,22 @@ function uploadFirmware(event) {
   progressText.textContent = 'Uploading firmware...';
   
   const xhr = new XMLHttpRequest();
-  xhr.open('POST', '/ota_update', true);
+  xhr.open('POST', force ? '/ota_update?force=1' : '/ota_update', true);
   xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+  if (preflight.sha256) {
+    xhr.setRequestHeader('X-Firmware-SHA256', preflight.sha256);
+  }
+  if (preflight.info) {
+    xhr.setRequestHeader('X-Firmware-Chip-Id', String(preflight.info.chipId));
+  }
   
   xhr.upload.onprogress = function(event) {
     if (event.lengthComputable) {
       const percentComplete = (event.loaded / event.total) * 100;
       progressFill.style.width = percentComplete + '%';
       const speed = (event.loaded / 1024).toFixed(1);
-      progressText.textContent = 'Uploading... ' + percentComplete.toFixed(1) + '% (' + speed + ' KB)';
+      progressText.textContent = 'Uploading... ' + percentComplete.toFixed(1) + '% (' + speed + ' KB)' +
+        (preflight.slices ? ' - slice ' + currentSlice(preflight.slices, event.loaded) + '/' + preflight.slices.length : '');
     }
   };
   
@@ -205,31 +401,17 @@ function uploadFirmware(event) {
       if (xhr.status === 200) {
         // Success - show in progress bar
         progressFill.style.width = '100%';
-        progressText.textContent = 'Update successful! Restarting system...';
-        showStatus('<span class="spinner"></span>Update successful! Restarting system...', 'success');
-        
-        let countdown = 15;
-        const restartInterval = setInterval(function() {
-          if (countdown > 0) {
-            progressText.textContent = 'Restarting in ' + countdown + ' seconds...';
-            showStatus(
-              '<span class="spinner"></span>Update successful! System restarting in ' + countdown + ' seconds...<br><small>Please wait for the device to restart</small>',
-              'success'
-            );
-            countdown--;
-          } else {
-            clearInterval(restartInterval);
-            document.title = 'Update Complete - System Restarted';
-            progressText.textContent = 'Update Complete!';
-            showStatus(
-              '<strong>Firmware update completed successfully!</strong><br>' +
-              'The system has restarted with the new firmware.<br>' +
-              '<small>You can now close this window or disconnect from the WiFi network.</small>',
-              'success'
-            );
-            document.getElementById('uploadForm').style.display = 'none';
-          }
-        }, 1000);
+        let result = {};
+        try {
+          result = JSON.parse(xhr.responseText);
+        } catch (e) {
+          // Older firmware answers with plain text and always reboots
+        }
+        if (result.status === 'staged') {
+          showStaged(result.partition);
+        } else {
+          showRestartCountdown();
+        }
         
       } else {
         // Error handling - reset to upload button
@@ -254,6 +436,76 @@ function uploadFirmware(event) {
   xhr.send(file);
 }
 
+function deviceAutoReboot() {
+  if (deviceInfo && typeof deviceInfo.auto_reboot === 'boolean') {
+    return deviceInfo.auto_reboot;
+  }
+  return typeof CONFIG_AUTO_REBOOT !== 'undefined' ? CONFIG_AUTO_REBOOT : true;
+}
+
+function showRestartCountdown() {
+  const progressText = document.getElementById('progressText');
+  progressText.textContent = 'Update successful! Restarting system...';
+  showStatus('<span class="spinner"></span>Update successful! Restarting system...', 'success');
+
+  let countdown = 15;
+
+  const restartInterval = setInterval(function() {
+    if (countdown > 0) {
+      progressText.textContent = 'Restarting in ' + countdown + ' seconds...';
+      showStatus(
+        '<span class="spinner"></span>Update successful! System restarting in ' + countdown + ' seconds...<br><small>Please wait for the device to restart</small>',
+        'success'
+      );
+      countdown--;
+    } else {
+      clearInterval(restartInterval);
+      document.title = 'Update Complete - System Restarted';
+      progressText.textContent = 'Update Complete!';
+      showStatus(
+        '<strong>Firmware update completed successfully!</strong><br>' +
+        'The system has restarted with the new firmware.<br>' +
+        '<small>You can now close this window or disconnect from the WiFi network.</small>',
+        'success'
+      );
+      document.getElementById('uploadForm').style.display = 'none';
+    }
+  }, 1000);
+}
+
+// Image is written and verified but the device keeps running the old firmware until activated
+function showStaged(partition) {
+  document.getElementById('progressText').textContent = 'Firmware staged';
+  showStatus(
+    '<strong>Firmware staged' + (partition ? ' in ' + partition : '') + '</strong><br>' +
+    'The device keeps running the current firmware until the update is activated.<br>' +
+    '<button type="button" class="btn-primary" id="activateButton" onclick="activateStaged()">Activate and restart</button>',
+    'success'
+  );
+}
+
+function activateStaged() {
+  const activateButton = document.getElementById('activateButton');
+  if (activateButton) {
+    activateButton.disabled = true;
+  }
+
+  const xhr = new XMLHttpRequest();
+  xhr.open('POST', '/activate', true);
+  xhr.onload = function() {
+    if (xhr.status === 200) {
+      showRestartCountdown();
+    } else {
+      showStatus('<strong>Activation Failed</strong><br>' + getDetailedErrorMessage(xhr.status, xhr.responseText), 'error');
+    }
+  };
+  xhr.onerror = function() {
+    showStatus('<strong>Activation Failed</strong><br>Network error occurred', 'error');
+  };
+  xhr.send();
+}
+
 window.onload = function() {
   setupDragDrop();
+  loadDeviceInfo();
 };
@@ -0,0 +1,162 @@
+// Upload pre-flight, runs as a Web Worker so hashing a large image never blocks the page.
+// Input:  { file, chipId, sliceSize }
+// Output: { type: 'progress', percent } while hashing, then
+//         { type: 'done', info, sha256, slices } or { type: 'error', message }
+
+const IMAGE_HEADER_MAGIC = 0xE9;
+const APP_DESC_OFFSET = 32;
+const APP_DESC_MAGIC = 0xABCD5432;
+const IMAGE_INFO_BYTES = APP_DESC_OFFSET + 256;
+
+// SHA-256 (FIPS 180-4). crypto.subtle is unavailable on plain-http pages such as the device portal.
+const K = new Uint32Array([
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+]);
+
+function Sha256() {
+  this.h = new Uint32Array([
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  ]);
+  this.w = new Uint32Array(64);
+  this.block = new Uint8Array(64);
+  this.blockLen = 0;
+  this.total = 0;
+}
+
+Sha256.prototype.compress = function(bytes, offset) {
+  const w = this.w;
+  const h = this.h;
+  for (let i = 0; i < 16; i++) {
+    const j = offset + i * 4;
+    w[i] = (bytes[j] << 24) | (bytes[j + 1] << 16) | (bytes[j + 2] << 8) | bytes[j + 3];
+  }
+  for (let i = 16; i < 64; i++) {
+    const x = w[i - 15];
+    const y = w[i - 2];
+    const s0 = ((x >>> 7) | (x << 25)) ^ ((x >>> 18) | (x << 14)) ^ (x >>> 3);
+    const s1 = ((y >>> 17) | (y << 15)) ^ ((y >>> 19) | (y << 13)) ^ (y >>> 10);
+    w[i] = (w[i - 16] + s0 + w[i - 7] + s1) | 0;
+  }
+
+  let a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+  for (let i = 0; i < 64; i++) {
+    const S1 = ((e >>> 6) | (e << 26)) ^ ((e >>> 11) | (e << 21)) ^ ((e >>> 25) | (e << 7));
+    const ch = (e & f) ^ (~e & g);
+    const t1 = (hh + S1 + ch + K[i] + w[i]) | 0;
+    const S0 = ((a >>> 2) | (a << 30)) ^ ((a >>> 13) | (a << 19)) ^ ((a >>> 22) | (a << 10));
+    const maj = (a & b) ^ (a & c) ^ (b & c);
+    const t2 = (S0 + maj) | 0;
+    hh = g; g = f; f = e; e = (d + t1) | 0;
+    d = c; c = b; b = a; a = (t1 + t2) | 0;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+  h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+};
+
+Sha256.prototype.update = function(bytes) {
+  let i = 0;
+  this.total += bytes.length;
+  if (this.blockLen > 0) {
+    while (i < bytes.length && this.blockLen < 64) {
+      this.block[this.blockLen++] = bytes[i++];
+    }
+    if (this.blockLen < 64) {
+      return;
+    }
+    this.compress(this.block, 0);
+    this.blockLen = 0;
+  }
+  for (; i + 64 <= bytes.length; i += 64) {
+    this.compress(bytes, i);
+  }
+  while (i < bytes.length) {
+    this.block[this.blockLen++] = bytes[i++];
+  }
+};
+
+Sha256.prototype.hex = function() {
+  const bitsHigh = Math.floor(this.total / 0x20000000);
+  const bitsLow = (this.total << 3) >>> 0;
+  const padLen = this.blockLen < 56 ? 56 - this.blockLen : 120 - this.blockLen;
+  const pad = new Uint8Array(padLen + 8);
+  pad[0] = 0x80;
+  const view = new DataView(pad.buffer);
+  view.setUint32(padLen, bitsHigh);
+  view.setUint32(padLen + 4, bitsLow);
+  const total = this.total;
+  this.update(pad);
+  this.total = total;
+
+  let out = '';
+  for (let i = 0; i < 8; i++) {
+    out += ('00000000' + this.h[i].toString(16)).slice(-8);
+  }
+  return out;
+};
+
+function readCString(bytes, offset, length) {
+  let str = '';
+  for (let i = offset; i < offset + length && bytes[i] !== 0; i++) {
+    str += String.fromCharCode(bytes[i]);
+  }
+  return str;
+}
+
+function toHex(bytes) {
+  return Array.prototype.map.call(bytes, function(b) {
+    return ('0' + b.toString(16)).slice(-2);
+  }).join('');
+}
+
+function parseImage(bytes) {
+  if (bytes.length < IMAGE_INFO_BYTES || bytes[0] !== IMAGE_HEADER_MAGIC) {
+    return null;
+  }
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  if (view.getUint32(APP_DESC_OFFSET, true) !== APP_DESC_MAGIC) {
+    return null;
+  }
+  return {
+    chipId: view.getUint16(12, true),
+    version: readCString(bytes, APP_DESC_OFFSET + 16, 32),
+    project: readCString(bytes, APP_DESC_OFFSET + 48, 32),
+    idf: readCString(bytes, APP_DESC_OFFSET + 112, 32),
+    elfSha256: toHex(bytes.subarray(APP_DESC_OFFSET + 144, APP_DESC_OFFSET + 176))
+  };
+}
+
+self.onmessage = function(e) {
+  const file = e.data.file;
+  const sliceSize = e.data.sliceSize || 64 * 1024;
+  const reader = new FileReaderSync();
+
+  const head = new Uint8Array(reader.readAsArrayBuffer(file.slice(0, IMAGE_INFO_BYTES)));
+  const info = parseImage(head);
+  if (!info) {
+    self.postMessage({ type: 'error', message: 'File is not an ESP-IDF application image' });
+    return;
+  }
+  if (typeof e.data.chipId === 'number' && info.chipId !== e.data.chipId) {
+    self.postMessage({ type: 'error', message: 'Image is built for a different chip (image chip id ' + info.chipId + ', device ' + e.data.chipId + ')' });
+    return;
+  }
+
+  // Hash slice by slice; the slice table doubles as the upload progress map
+  const sha = new Sha256();
+  const slices = [];
+  for (let offset = 0, seq = 0; offset < file.size; offset += sliceSize, seq++) {
+    const length = Math.min(sliceSize, file.size - offset);
+    sha.update(new Uint8Array(reader.readAsArrayBuffer(file.slice(offset, offset + length))));
+    slices.push({ seq: seq, offset: offset, length: length });
+    self.postMessage({ type: 'progress', percent: ((offset + length) / file.size) * 100 });
+  }
+
+  self.postMessage({ type: 'done', info: info, sha256: sha.hex(), slices: slices });
+};
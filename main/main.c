@@ -1,11 +1,172 @@
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "nvs_flash.h"
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "simpleOTA.h"
+#if CONFIG_EXAMPLE_JITTER_PROBE
+#include "esp_timer.h"
+#endif
+#if CONFIG_EXAMPLE_FIRMWARE_SELF_CHECK
+#include "esp_http_client.h"
+#include "mbedtls/sha256.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#endif
 
 static const char* TAG = "MAIN";
 
+// Example health check: new firmware must still have spare heap once it has settled
+static bool heap_health_check(void* arg)
+{
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    return esp_get_free_heap_size() > 32 * 1024;
+}
+
+#if CONFIG_EXAMPLE_START_STOP_SOAK
+// Leak/fragmentation regression: the first cycle is the baseline, since Wi-Fi and
+// the event loop allocate once on first use and keep that memory
+static void start_stop_soak(void)
+{
+    size_t baseline_free = 0;
+    size_t baseline_block = 0;
+
+    for (int cycle = 0; cycle < CONFIG_EXAMPLE_SOAK_CYCLES; cycle++) {
+        ESP_ERROR_CHECK(simpleOTA_start());
+        vTaskDelay(pdMS_TO_TICKS(2000)); // AP, mDNS and web server are up by now
+        ESP_ERROR_CHECK(simpleOTA_stop());
+        vTaskDelay(pdMS_TO_TICKS(500));
+
+        size_t free_heap = esp_get_free_heap_size();
+        size_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+        if (cycle == 0) {
+            baseline_free = free_heap;
+            baseline_block = largest_block;
+            continue;
+        }
+
+        long free_drift = (long)baseline_free - (long)free_heap;
+        long block_drift = (long)baseline_block - (long)largest_block;
+        if (cycle % 10 == 0) {
+            ESP_LOGI(TAG, "Soak cycle %d: free %u (drift %ld), largest block %u (drift %ld)",
+                     cycle, (unsigned)free_heap, free_drift, (unsigned)largest_block, block_drift);
+        }
+        if (free_drift > CONFIG_EXAMPLE_SOAK_MAX_DRIFT_BYTES || block_drift > CONFIG_EXAMPLE_SOAK_MAX_DRIFT_BYTES) {
+            ESP_LOGE(TAG, "Soak FAILED at cycle %d: free heap drift %ld, largest block drift %ld",
+                     cycle, free_drift, block_drift);
+            abort();
+        }
+    }
+
+    simple_ota_memory_t memory;
+    simpleOTA_getMemoryBudget(&memory);
+    ESP_LOGI(TAG, "Soak PASSED: %d cycles, OTA stack arena %u/%u bytes, min stack headroom %u bytes",
+             CONFIG_EXAMPLE_SOAK_CYCLES, (unsigned)memory.static_used, (unsigned)memory.static_budget,
+             (unsigned)memory.min_stack_headroom);
+}
+#endif
+
+#if CONFIG_EXAMPLE_JITTER_PROBE
+#ifndef CONFIG_EXAMPLE_JITTER_CORE
+#define CONFIG_EXAMPLE_JITTER_CORE 0
+#endif
+
+// Stand-in control loop: reports wake-up lateness every 5 seconds, tagged with the OTA state
+static void jitter_probe_task(void* pvParameters)
+{
+    const int64_t period_us = CONFIG_EXAMPLE_JITTER_PERIOD_MS * 1000;
+    const int report_every = 5000 / CONFIG_EXAMPLE_JITTER_PERIOD_MS;
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t expected = esp_timer_get_time() + period_us;
+    int64_t worst_us = 0;
+    int64_t total_us = 0;
+    int samples = 0;
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_EXAMPLE_JITTER_PERIOD_MS));
+        int64_t now = esp_timer_get_time();
+        int64_t late_us = now > expected ? now - expected : expected - now;
+        expected += period_us;
+
+        total_us += late_us;
+        if (late_us > worst_us) {
+            worst_us = late_us;
+        }
+
+        if (++samples >= report_every) {
+            ESP_LOGI(TAG, "Jitter (OTA status %d): avg %lld us, worst %lld us",
+                     simpleOTA_getStatus(), (long long)(total_us / samples), (long long)worst_us);
+            worst_us = 0;
+            total_us = 0;
+            samples = 0;
+            // Re-anchor so tick rounding does not accumulate into the next window
+            expected = esp_timer_get_time() + period_us;
+            last_wake = xTaskGetTickCount();
+        }
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_FIRMWARE_SELF_CHECK
+static esp_err_t self_check_header(esp_http_client_event_t* evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, "X-Firmware-SHA256") == 0) {
+        snprintf((char*)evt->user_data, 65, "%s", evt->header_value);
+    }
+    return ESP_OK;
+}
+
+// Neighbours refuse a mirror pull whose body does not hash to X-Firmware-SHA256, so
+// download our own /firmware over loopback and check the two agree
+static void firmware_self_check(void)
+{
+    static char buffer[1024];
+    char header_hex[65] = "";
+    char body_hex[65] = "";
+    uint8_t digest[32];
+    size_t total = 0;
+
+    esp_http_client_config_t config = {
+        .url = "http://127.0.0.1/firmware",
+        .timeout_ms = 10000,
+        .event_handler = self_check_header,
+        .user_data = header_hex,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client || esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0 ||
+        esp_http_client_get_status_code(client) != 200) {
+        ESP_LOGE(TAG, "Firmware self-check FAILED: GET /firmware did not answer 200");
+        abort();
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    int len;
+    while ((len = esp_http_client_read(client, buffer, sizeof(buffer))) > 0) {
+        mbedtls_sha256_update(&sha, (const unsigned char*)buffer, len);
+        total += len;
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    bool complete = esp_http_client_is_complete_data_received(client);
+    esp_http_client_cleanup(client);
+
+    for (int i = 0; i < 32; i++) {
+        sprintf(&body_hex[i * 2], "%02x", digest[i]);
+    }
+    if (!complete || strcmp(header_hex, body_hex) != 0) {
+        ESP_LOGE(TAG, "Firmware self-check FAILED: %u bytes hash to %s, header says %s",
+                 (unsigned)total, body_hex, header_hex[0] ? header_hex : "(none)");
+        abort();
+    }
+    ESP_LOGI(TAG, "Firmware self-check PASSED: %u bytes, sha256 %s", (unsigned)total, body_hex);
+}
+#endif
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "Starting ESP OTA Application");
@@ -18,14 +179,29 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // Validate any pending OTA updates
+    // Validate any pending OTA updates, health checks run in the background
+    simpleOTA_registerHealthCheck("heap", heap_health_check, NULL, 10000);
     simpleOTA_validateOnBoot();
 
+#if CONFIG_EXAMPLE_JITTER_PROBE
+    xTaskCreatePinnedToCore(jitter_probe_task, "jitter_probe", 3072, NULL,
+                            CONFIG_EXAMPLE_JITTER_PRIORITY, NULL, CONFIG_EXAMPLE_JITTER_CORE);
+#endif
+
+#if CONFIG_EXAMPLE_START_STOP_SOAK
+    start_stop_soak();
+#endif
+
     // Start OTA with kconfig settings
     ESP_ERROR_CHECK(simpleOTA_start());
 
     ESP_LOGI(TAG, "OTA Ready! Connect to 'Simple OTA' AP and visit simpleOTA.local");
 
+#if CONFIG_EXAMPLE_FIRMWARE_SELF_CHECK
+    vTaskDelay(pdMS_TO_TICKS(2000)); // Web server is up by now
+    firmware_self_check();
+#endif
+
     while(1) {
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
@@ -0,0 +1,307 @@
+#!/usr/bin/env python3
+"""Linux stand-in for a simpleOTA device's upload API.
+
+Answers GET /info and POST /ota_update the way otaHandler.c does: the same status
+codes and JSON errors, X-Firmware-SHA256 / X-Firmware-Chip-Id / X-Firmware-Size
+checks, Content-Encoding: deflate, and ?offset= resume of an upload whose
+connection dropped. Use it to run tools/simpleota_upload (or curl) in CI without
+hardware:
+
+    ota_standin.py --port 8080 --output received.bin --rate 400
+    simpleota_upload -H 127.0.0.1 -p 8080 -z build/app.bin
+
+--rate caps the accepted rate in KB/s, as flash writes would. --interrupt-at drops
+the connection once after that many image bytes, leaving the upload to be resumed.
+An activated image becomes the "running" one, so sending it again gets 409.
+"""
+
+import argparse
+import hashlib
+import json
+import socket
+import struct
+import threading
+import time
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+APP_DESC_OFFSET = 32
+APP_DESC_MAGIC = 0xABCD5432
+IMAGE_INFO_BYTES = APP_DESC_OFFSET + 256
+READ_BYTES = 4096
+RESUME_TIMEOUT_S = 120  # CONFIG_SIMPLE_OTA_RESUME_TIMEOUT_S
+SLOT_SIZE = 0x180000
+# Small like lwIP's TCP window, so the client's send time tracks the stand-in's reads
+# instead of ending once the body fits the kernel buffers
+RECEIVE_BUFFER = 16 * 1024
+
+
+def app_desc(image):
+    """The /info "app" fields of an image, None if it is not an app image."""
+    if len(image) < IMAGE_INFO_BYTES or image[0] != 0xE9:
+        return None
+    desc = image[APP_DESC_OFFSET:IMAGE_INFO_BYTES]
+    if struct.unpack_from("<I", desc)[0] != APP_DESC_MAGIC:
+        return None
+
+    def text(offset, size):
+        return desc[offset:offset + size].split(b"\0")[0].decode("ascii", "replace")
+
+    return {
+        "version": text(16, 32), "project": text(48, 32), "idf": text(112, 32),
+        "date": text(96, 16), "time": text(80, 16), "elf_sha256": desc[144:176].hex(), "secure_version": 0,
+    }
+
+
+class Device:
+    """OTA state shared by all requests: the running app and at most one session."""
+
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.running = None
+        if args.running:
+            with open(args.running, "rb") as f:
+                self.running = app_desc(f.read())
+        self.running = self.running or {
+            "version": "0.0.0", "project": "standin", "idf": "v5.1", "date": "", "time": "",
+            "elf_sha256": "0" * 64, "secure_version": 0,
+        }
+        self.session = None  # dict(expected, sha256, data, suspended_at) while an upload is open
+        self.interrupt_at = args.interrupt_at
+        self.staged = False
+
+    def info(self):
+        with self.lock:
+            session = self.resumable()
+            return {
+                "app": self.running,
+                "chip": {"target": "standin", "chip_id": self.args.chip_id, "revision": 0, "cores": 2},
+                "running_partition": "ota_0", "next_partition": "ota_1", "free_slot_size": self.args.slot_size,
+                "max_upload_size": self.args.max_upload_size, "worst_flash_stall_us": 0,
+                "auto_reboot": not self.args.staged, "staged": self.staged,
+                "health_pending": False, "boot_to_valid_ms": 0,
+                "upload": {
+                    "resume_offset": len(session["data"]) if session else 0,
+                    "resume_sha256": session["sha256"] if session else "",
+                    "deflate": not self.args.no_deflate,
+                },
+                "partitions": [],
+            }
+
+    def resumable(self):
+        session = self.session
+        if session and session["suspended_at"] is not None:
+            if time.monotonic() - session["suspended_at"] <= RESUME_TIMEOUT_S:
+                return session
+            self.session = None
+        return None
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def server_bind(self):
+        self.socket.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, RECEIVE_BUFFER)
+        super().server_bind()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    device = None
+
+    def log_message(self, fmt, *args):
+        if self.device.args.verbose:
+            super().log_message(fmt, *args)
+
+    def reply(self, status, body):
+        data = json.dumps(body, separators=(",", ":")).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.send_header("Connection", "close")
+        self.end_headers()
+        self.wfile.write(data)
+        self.close_connection = True
+
+    def error(self, status, error, details, **extra):
+        self.reply(status, dict(error=error, details=details, **extra))
+
+    def do_GET(self):
+        if urlparse(self.path).path == "/info":
+            self.reply(200, self.device.info())
+        else:
+            self.error(404, "Not found", "The stand-in serves /info and /ota_update only")
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        if url.path != "/ota_update":
+            self.error(404, "Not found", "The stand-in serves /info and /ota_update only")
+            return
+        query = parse_qs(url.query)
+        offset = int(query.get("offset", ["0"])[0])
+        force = query.get("force", ["0"])[0] == "1"
+        length = int(self.headers.get("Content-Length", "0"))
+        deflate = self.headers.get("Content-Encoding", "") == "deflate"
+        sha256 = self.headers.get("X-Firmware-SHA256", "").lower()
+        chip_id = self.headers.get("X-Firmware-Chip-Id")
+        expected = int(self.headers.get("X-Firmware-Size", "0" if deflate else str(offset + length)))
+        device = self.device
+
+        if chip_id is not None and int(chip_id, 0) != device.args.chip_id:
+            self.error(400, "Wrong chip", "This firmware is built for a different ESP32 variant.")
+            return
+        if expected > min(device.args.slot_size, device.args.max_upload_size):
+            self.error(413, "File too large", "Firmware does not fit the OTA partition")
+            return
+        if deflate and device.args.no_deflate:
+            self.error(415, "Compression not supported", "Send the image uncompressed")
+            return
+
+        with device.lock:
+            session = device.resumable()
+            if device.session and not session:
+                self.error(503, "Device busy", "Another firmware update is in progress")
+                return
+            if offset > 0:
+                if not session or len(session["data"]) != offset or session["sha256"] != sha256 or \
+                        session["expected"] != expected:
+                    self.error(416, "Cannot resume upload", "No matching interrupted upload at this offset",
+                               resume_offset=len(session["data"]) if session else 0)
+                    return
+            else:
+                session = None
+            # Claimed: no other request may use it until it is suspended again
+            device.session = session or {"expected": expected, "sha256": sha256, "data": bytearray(),
+                                         "suspended_at": None}
+            device.session["suspended_at"] = None
+            session = device.session
+
+        self.receive(session, length, deflate, force, offset)
+
+    def receive(self, session, length, deflate, force, offset):
+        device = self.device
+        inflator = zlib.decompressobj() if deflate else None
+        remaining = length
+        started = time.monotonic()
+        received = 0
+        checked = offset > 0
+
+        def suspend():
+            with device.lock:
+                if session["sha256"] and session["data"]:
+                    session["suspended_at"] = time.monotonic()
+                else:
+                    device.session = None
+
+        def abort():
+            with device.lock:
+                device.session = None
+
+        while remaining > 0:
+            try:
+                block = self.rfile.read(min(READ_BYTES, remaining))
+            except OSError:
+                block = b""
+            if not block:
+                suspend()
+                self.error(500, "File reception failed", "Network error during file upload")
+                return
+            remaining -= len(block)
+            if inflator:
+                try:
+                    block = inflator.decompress(block)
+                except zlib.error:
+                    abort()
+                    self.error(400, "Invalid compressed data", "The deflate stream could not be decoded")
+                    return
+            session["data"] += block
+            received += len(block)
+
+            # Nothing is written until the image has been identified, as on the device
+            if not checked and len(session["data"]) >= IMAGE_INFO_BYTES:
+                checked = True
+                desc = app_desc(bytes(session["data"][:IMAGE_INFO_BYTES]))
+                if desc is None:
+                    abort()
+                    self.error(400, "Invalid firmware file", "File is not a valid ESP32 firmware. "
+                               "Ensure you're uploading a .bin file built for this device.")
+                    return
+                if desc["elf_sha256"] == device.running["elf_sha256"] and not force:
+                    abort()
+                    self.error(409, "Firmware already installed", "The device is already running this image. "
+                               "Upload with force=1 to reinstall it.")
+                    return
+
+            if device.interrupt_at is not None and len(session["data"]) >= device.interrupt_at:
+                device.interrupt_at = None
+                print("Dropping the connection at %d image bytes" % len(session["data"]))
+                suspend()
+                self.close_connection = True
+                self.connection.shutdown(2)
+                return
+
+            if device.args.rate:
+                ahead = received / (device.args.rate * 1024) - (time.monotonic() - started)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+        if inflator and not inflator.eof:
+            abort()
+            self.error(400, "Invalid compressed data", "The deflate stream could not be decoded")
+            return
+
+        image = bytes(session["data"])
+        abort()
+        if not image:
+            self.error(400, "No firmware data received", "Empty file or upload interrupted")
+            return
+        if session["expected"] and len(image) != session["expected"]:
+            self.error(400, "Invalid firmware file", "Received %d bytes, expected %d" % (len(image), session["expected"]))
+            return
+        if session["sha256"] and hashlib.sha256(image).hexdigest() != session["sha256"]:
+            self.error(400, "Firmware digest mismatch",
+                       "The received image does not match the SHA-256 computed before upload. Please retry.")
+            return
+
+        if device.args.output:
+            with open(device.args.output, "wb") as f:
+                f.write(image)
+        print("Received %d byte image in %.2f s" % (len(image), time.monotonic() - started))
+        if device.args.staged:
+            device.staged = True
+            self.reply(200, {"status": "staged", "partition": "ota_1"})
+        else:
+            device.running = app_desc(image)
+            self.reply(200, {"status": "activated", "reboot_in_ms": 500})
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter, epilog=__doc__)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--bind", default="127.0.0.1")
+    parser.add_argument("--output", help="write each received image here")
+    parser.add_argument("--running", help="app image the stand-in reports as running")
+    parser.add_argument("--chip-id", type=lambda v: int(v, 0), default=0, help="esp_chip_id_t, 0 is esp32")
+    parser.add_argument("--slot-size", type=int, default=SLOT_SIZE)
+    parser.add_argument("--max-upload-size", type=int, default=2 * 1024 * 1024)
+    parser.add_argument("--rate", type=float, default=0, help="accepted image rate in KB/s, 0 for unlimited")
+    parser.add_argument("--interrupt-at", type=int, help="drop the connection once after this many image bytes")
+    parser.add_argument("--no-deflate", action="store_true", help="answer compressed uploads with 415")
+    parser.add_argument("--staged", action="store_true", help="stage images instead of activating them")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    Handler.device = Device(args)
+    server = Server((args.bind, args.port), Handler)
+    print("simpleOTA stand-in on http://%s:%d" % (args.bind, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
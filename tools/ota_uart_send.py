@@ -0,0 +1,420 @@
+#!/usr/bin/env python3
+"""Send firmware to a simpleOTA device over a serial line.
+
+Speaks the sliding-window protocol in components/simpleOTA/include/otaWindow.h:
+CRC-checked frames, a window of chunks in flight, and selective retransmission
+of the chunks the device's ACK bitmap reports missing.
+
+    ota_uart_send.py send /dev/ttyUSB0 build/app.bin --baud 921600
+    ota_uart_send.py receive /dev/pts/4 out.bin      # reference receiver
+    ota_uart_send.py loopback build/app.bin --baud 921600 --loss 0.01
+
+"loopback" runs the sender and the reference receiver over a pseudo-terminal
+pair in one process, pacing both directions at the given baud rate, so the
+protocol and its efficiency can be checked on Linux without hardware. For two
+processes, create a pair with "socat -d -d pty,raw,echo=0 pty,raw,echo=0".
+Every run reports payload throughput against the line rate (baud / 10).
+"""
+
+import argparse
+import hashlib
+import os
+import random
+import select
+import struct
+import sys
+import threading
+import time
+import zlib
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<2sBBIH")
+OVERHEAD = HEADER.size + 4
+MAX_PAYLOAD = 4096
+
+START, READY, DATA, ACK, END, RESULT, ABORT = range(1, 8)
+FLAG_SHA256 = 0x01
+FLAG_FORCE = 0x02
+# Give up once the retransmit timeout has backed off beyond this
+STALL_SECONDS = 20
+OUTCOMES = {0: "failed", 1: "staged", 2: "activated, device is rebooting"}
+
+ESP_ERRORS = {
+    0x101: "ESP_ERR_NO_MEM",
+    0x102: "ESP_ERR_INVALID_ARG",
+    0x103: "ESP_ERR_INVALID_STATE",
+    0x104: "ESP_ERR_INVALID_SIZE",
+    0x105: "ESP_ERR_NOT_FOUND",
+    0x109: "ESP_ERR_INVALID_CRC",
+    0x1503: "ESP_ERR_OTA_VALIDATE_FAILED",
+    0x1540: "image already running (use --force)",
+}
+
+
+def encode(kind, seq=0, payload=b""):
+    body = HEADER.pack(SYNC, kind, 0, seq, len(payload))[2:] + payload
+    return SYNC + body + struct.pack("<I", zlib.crc32(body))
+
+
+class Parser:
+    """Byte stream to frames, resynchronising on the sync bytes like otaFrame_parse()."""
+
+    def __init__(self, max_payload=MAX_PAYLOAD):
+        self.buffer = bytearray()
+        self.max_payload = max_payload
+        self.crc_errors = 0
+
+    def feed(self, data):
+        if not data:
+            # An idle line ends any partial frame, it was corrupted
+            self.buffer.clear()
+            return []
+        self.buffer += data
+        frames = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                del self.buffer[:-1 if self.buffer.endswith(SYNC[:1]) else len(self.buffer)]
+                return frames
+            del self.buffer[:start]
+            if len(self.buffer) < HEADER.size:
+                return frames
+            _, kind, _, seq, length = HEADER.unpack_from(self.buffer)
+            if length > self.max_payload:
+                self.crc_errors += 1
+                del self.buffer[:2]
+                continue
+            if len(self.buffer) < length + OVERHEAD:
+                return frames
+            frame = bytes(self.buffer[:length + OVERHEAD])
+            del self.buffer[:length + OVERHEAD]
+            (crc,) = struct.unpack_from("<I", frame, HEADER.size + length)
+            if zlib.crc32(frame[2:HEADER.size + length]) != crc:
+                self.crc_errors += 1
+                continue
+            frames.append((kind, seq, frame[HEADER.size:HEADER.size + length]))
+
+
+class Line:
+    """One end of a serial line. Optionally paces writes to the baud rate and corrupts frames."""
+
+    def __init__(self, fd, baud, pace=False, loss=0.0, rng=None):
+        self.fd = fd
+        self.baud = baud
+        self.pace = pace
+        self.loss = loss
+        self.rng = rng or random.Random()
+        self.start = time.monotonic()
+        self.written = 0
+        self.corrupted = 0
+        self.rate = baud / 10  # Payload bytes per second
+
+    def frame_time(self, size):
+        return size / self.rate
+
+    def write(self, data):
+        if self.loss and self.rng.random() < self.loss:
+            data = bytearray(data)
+            data[self.rng.randrange(len(data))] ^= 0xFF
+            self.corrupted += 1
+        if self.pace:
+            due = self.start + (self.written + len(data)) * 10 / self.baud
+            delay = due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        view = memoryview(bytes(data))
+        while view:
+            sent = os.write(self.fd, view)
+            view = view[sent:]
+        self.written += len(data)
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], max(timeout, 0))
+        if not ready:
+            return b""
+        try:
+            return os.read(self.fd, 4096)
+        except OSError:
+            return b""
+
+
+def open_serial(path, baud):
+    import termios
+    import tty
+
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        sys.exit("Baud rate %d is not supported by termios on this system" % baud)
+    attrs = termios.tcgetattr(fd)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+class Sender:
+    def __init__(self, line, image, force=False, verbose=False, parser=None):
+        self.line = line
+        self.image = image
+        self.force = force
+        self.verbose = verbose
+        # Device frames are all small, a bigger length is corruption
+        self.parser = parser or Parser(max_payload=64)
+        self.rtt = 0.0
+        self.frames_sent = 0
+        self.retransmits = 0
+        self.timeouts = 0
+
+    def receive(self, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            frames = self.parser.feed(self.line.read(deadline - time.monotonic()))
+            if frames or time.monotonic() >= deadline:
+                return frames
+
+    def send_frame(self, kind, seq=0, payload=b""):
+        self.line.write(encode(kind, seq, payload))
+        self.frames_sent += 1
+
+    def handshake(self):
+        flags = FLAG_SHA256 | (FLAG_FORCE if self.force else 0)
+        start = struct.pack("<IBB", len(self.image), flags, 0) + hashlib.sha256(self.image).digest()
+        for _ in range(40):
+            sent = time.monotonic()
+            self.send_frame(START, 0, start)
+            for kind, _, payload in self.receive(0.25):
+                if kind == READY:
+                    self.rtt = time.monotonic() - sent
+                    return struct.unpack_from("<HH", payload)
+                if kind == RESULT:
+                    self.fail(payload)
+        sys.exit("No answer from the device, is its transport enabled and listening?")
+
+    def fail(self, payload):
+        err, outcome = struct.unpack_from("<iB", payload)
+        sys.exit("Device refused the image: %s (0x%x)" % (ESP_ERRORS.get(err, "error"), err))
+
+    def run(self):
+        window, chunk = self.handshake()
+        chunks = [self.image[i:i + chunk] for i in range(0, len(self.image), chunk)]
+        count = len(chunks)
+        frame_time = self.line.frame_time(chunk + OVERHEAD)
+        # Long enough for a full window, its ACKs and the round trip, doubled on every timeout
+        # without progress (the device may be erasing flash); progress resets it
+        base_rto = window * frame_time + 2 * self.rtt + 0.005
+        rto = base_rto
+        # A hole is only declared lost once a chunk sent this much later has arrived, so
+        # datagrams reordered in flight are not resent (RACK's reordering window)
+        reorder = self.rtt / 4
+        if self.verbose:
+            print("Device window %d x %d bytes, %d chunks, rto %.0f ms" % (window, chunk, count, base_rto * 1000))
+
+        order = [0] * count  # Send order of each chunk's latest transmission
+        sent_at = [0.0] * count
+        held = set()
+        counter = 0
+        base = 0
+        next_new = 0
+        last_progress = time.monotonic()
+
+        def transmit(index):
+            nonlocal counter
+            counter += 1
+            order[index] = counter
+            sent_at[index] = time.monotonic()
+            self.send_frame(DATA, index, chunks[index])
+
+        while True:
+            while next_new < count and next_new < base + window:
+                transmit(next_new)
+                next_new += 1
+
+            frames = self.receive(frame_time if next_new < min(count, base + window) else rto)
+            for kind, seq, payload in frames:
+                if kind == RESULT:
+                    return struct.unpack_from("<iB", payload)
+                if kind != ACK:
+                    continue
+                (bitmap,) = struct.unpack_from("<I", payload)
+                if seq > base:
+                    base = seq
+                    last_progress = time.monotonic()
+                    rto = base_rto
+                held = {seq + 1 + i for i in range(32) if bitmap & (1 << i)}
+                if held:
+                    # A chunk sent before one the device already holds is lost, send it again
+                    newest = max(held, key=lambda c: order[c])
+                    for index in range(base, max(held)):
+                        if (index not in held and order[index] < order[newest]
+                                and sent_at[newest] - sent_at[index] >= reorder):
+                            self.retransmits += 1
+                            transmit(index)
+
+            if base >= count:
+                break
+            if not frames and time.monotonic() - last_progress > rto:
+                if rto > STALL_SECONDS:
+                    sys.exit("Device stopped acknowledging at chunk %d of %d" % (base, count))
+                self.timeouts += 1
+                self.retransmits += 1
+                transmit(base)
+                last_progress = time.monotonic()
+                rto *= 2
+
+        # Every chunk is acknowledged; the device now verifies and commits the image, which
+        # takes a while, and answers every END that queued up meanwhile
+        for _ in range(40):
+            self.send_frame(END, count)
+            for kind, seq, payload in self.receive(max(rto, 0.25)):
+                if kind == RESULT:
+                    return struct.unpack_from("<iB", payload)
+        sys.exit("Device did not confirm the image")
+
+
+class Receiver:
+    """Reference receiver with the device's semantics, writes the image to a file."""
+
+    def __init__(self, line, output, window=8, chunk=1024, parser=None):
+        self.line = line
+        self.output = output
+        self.window = window
+        self.chunk = chunk
+        self.parser = parser or Parser()
+        self.running = True
+
+    def reply(self, kind, seq=0, payload=b""):
+        self.line.write(encode(kind, seq, payload))
+
+    def run(self):
+        expected = None
+        base = 0
+        held = {}
+        data = bytearray()
+        result = None
+        while self.running:
+            for kind, seq, payload in self.parser.feed(self.line.read(0.1)):
+                if kind == START:
+                    size, flags = struct.unpack_from("<IB", payload)
+                    expected = (size, payload[6:38] if flags & FLAG_SHA256 else None)
+                    base, held, data, result = 0, {}, bytearray(), None
+                    self.reply(READY, 0, struct.pack("<HH", self.window, self.chunk))
+                elif kind == DATA and expected and result is None:
+                    if base <= seq < base + self.window and len(payload) <= self.chunk:
+                        held[seq] = payload
+                        while base in held:
+                            data += held.pop(base)
+                            base += 1
+                    bitmap = sum(1 << (c - base - 1) for c in held if c - base - 1 < 32)
+                    self.reply(ACK, base, struct.pack("<I", bitmap))
+                elif kind in (DATA, END) and result is not None:
+                    self.reply(RESULT, 0, result)
+                elif kind == END and expected:
+                    if base < seq:
+                        bitmap = sum(1 << (c - base - 1) for c in held if c - base - 1 < 32)
+                        self.reply(ACK, base, struct.pack("<I", bitmap))
+                        continue
+                    size, sha = expected
+                    err = 0
+                    if len(data) != size:
+                        err = 0x104
+                    elif sha is not None and hashlib.sha256(data).digest() != sha:
+                        err = 0x109
+                    elif self.output:
+                        with open(self.output, "wb") as f:
+                            f.write(data)
+                    result = struct.pack("<iB", err, 0 if err else 1)
+                    self.reply(RESULT, 0, result)
+        return self.parser.crc_errors
+
+
+def report(sender, image, elapsed, line_rate, err, outcome):
+    """line_rate is in bytes per second, None when the link rate is unknown."""
+    throughput = len(image) / elapsed
+    if line_rate:
+        print("%d bytes in %.2f s: %.1f KB/s, line rate %.1f KB/s, efficiency %.1f%%"
+              % (len(image), elapsed, throughput / 1024, line_rate / 1024, 100 * throughput / line_rate))
+    else:
+        print("%d bytes in %.2f s: %.1f KB/s" % (len(image), elapsed, throughput / 1024))
+    print("%d frames sent, %d retransmitted, %d timeouts, %d corrupt replies"
+          % (sender.frames_sent, sender.retransmits, sender.timeouts, sender.parser.crc_errors))
+    if err != 0:
+        sys.exit("Device rejected the image: %s (0x%x)" % (ESP_ERRORS.get(err, "error"), err))
+    print("Image %s" % OUTCOMES.get(outcome, "accepted"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter, epilog=__doc__)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    send = sub.add_parser("send", help="send an image to a device")
+    send.add_argument("port")
+    send.add_argument("image")
+
+    receive = sub.add_parser("receive", help="run the reference receiver on a serial port")
+    receive.add_argument("port")
+    receive.add_argument("output")
+    receive.add_argument("--window", type=int, default=8)
+    receive.add_argument("--chunk", type=int, default=1024)
+
+    loop = sub.add_parser("loopback", help="sender and reference receiver over an in-process pty pair")
+    loop.add_argument("image")
+    loop.add_argument("--loss", type=float, default=0.0, help="probability that a frame is corrupted, each way")
+    loop.add_argument("--window", type=int, default=8)
+    loop.add_argument("--chunk", type=int, default=1024)
+    loop.add_argument("--seed", type=int, default=1)
+
+    for p in (send, receive, loop):
+        p.add_argument("--baud", type=int, default=921600)
+    for p in (send, loop):
+        p.add_argument("--force", action="store_true", help="reinstall even if the device already runs this image")
+        p.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    if args.command == "receive":
+        receiver = Receiver(Line(open_serial(args.port, args.baud), args.baud), args.output, args.window, args.chunk)
+        try:
+            receiver.run()
+        except KeyboardInterrupt:
+            pass
+        return
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    if args.command == "send":
+        line = Line(open_serial(args.port, args.baud), args.baud)
+        receiver = None
+    else:
+        import tty
+
+        host_fd, device_fd = os.openpty()
+        tty.setraw(device_fd)
+        rng = random.Random(args.seed)
+        line = Line(host_fd, args.baud, pace=True, loss=args.loss, rng=rng)
+        device_line = Line(device_fd, args.baud, pace=True, loss=args.loss, rng=random.Random(args.seed + 1))
+        output = args.image + ".received"
+        receiver = Receiver(device_line, output, args.window, args.chunk)
+        thread = threading.Thread(target=receiver.run, daemon=True)
+        thread.start()
+
+    sender = Sender(line, image, args.force, args.verbose)
+    started = time.monotonic()
+    err, outcome = sender.run()
+    elapsed = time.monotonic() - started
+
+    if receiver:
+        receiver.running = False
+        thread.join()
+        if err == 0:
+            with open(output, "rb") as f:
+                if f.read() != image:
+                    sys.exit("Loopback image differs from the original")
+            os.remove(output)
+    report(sender, image, elapsed, line.rate, err, outcome)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""Send firmware to a simpleOTA device over UDP.
+
+Same sliding-window protocol as ota_uart_send.py, one frame per datagram, to the
+UDP transport the device runs beside its web server in AP mode
+(CONFIG_SIMPLE_OTA_UDP). Lost datagrams are found from the device's selective
+ACK bitmaps and resent; there is no congestion backoff, so a lossy SoftAP link
+stays busy where a TCP upload to /ota_update collapses.
+
+    ota_udp_send.py send 10.0.0.1 build/app.bin
+    ota_udp_send.py receive out.bin --port 3232      # reference receiver
+    ota_udp_send.py loopback build/app.bin --loss 0.05 --delay 5 --jitter 2
+
+"loopback" runs the sender and the reference receiver on 127.0.0.1 through an
+emulated link: --rate caps its bandwidth, --delay and --jitter add one-way
+latency (jitter reorders datagrams) and --loss drops datagrams in both
+directions. "receive" is a stand-in device for testing a sender on Linux.
+"""
+
+import argparse
+import heapq
+import os
+import random
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+import zlib
+
+from ota_uart_send import HEADER, OVERHEAD, SYNC, Receiver, Sender, report
+
+DEFAULT_PORT = 3232
+
+
+class DatagramParser:
+    """Each datagram is one whole frame, checked like otaFrame_decode()."""
+
+    def __init__(self):
+        self.crc_errors = 0
+
+    def feed(self, data):
+        if not data:
+            return []
+        if len(data) < OVERHEAD or not data.startswith(SYNC):
+            self.crc_errors += 1
+            return []
+        _, kind, _, seq, length = HEADER.unpack_from(data)
+        (crc,) = struct.unpack_from("<I", data, len(data) - 4)
+        if length + OVERHEAD != len(data) or zlib.crc32(data[2:-4]) != crc:
+            self.crc_errors += 1
+            return []
+        return [(kind, seq, data[HEADER.size:-4])]
+
+
+class Link:
+    """One end of a UDP link, with the Line interface Sender and Receiver expect.
+
+    With emulate set, outgoing datagrams are dropped with probability loss, paced to
+    rate bytes per second and delivered delay (+ up to jitter) seconds later.
+    Without it, rate is only an estimate used for the sender's timers.
+    """
+
+    def __init__(self, sock, peer=None, rate=1.25e6, emulate=False, loss=0.0, delay=0.0, jitter=0.0, rng=None):
+        self.sock = sock
+        self.peer = peer
+        self.rate = rate
+        self.emulate = emulate
+        self.loss = loss
+        self.delay = delay
+        self.jitter = jitter
+        self.rng = rng or random.Random()
+        self.dropped = 0
+        self.link_free = time.monotonic()
+        self.queue = []
+        self.queued = 0
+        self.wake = threading.Condition()
+        if emulate:
+            threading.Thread(target=self.deliver, daemon=True).start()
+
+    def frame_time(self, size):
+        return size / self.rate
+
+    def write(self, data):
+        if self.peer is None:
+            return
+        if not self.emulate:
+            self.sock.sendto(data, self.peer)
+            return
+        now = time.monotonic()
+        self.link_free = max(now, self.link_free) + len(data) / self.rate
+        if self.loss and self.rng.random() < self.loss:
+            self.dropped += 1
+            return
+        due = self.link_free + self.delay + self.rng.uniform(0, self.jitter)
+        with self.wake:
+            self.queued += 1
+            heapq.heappush(self.queue, (due, self.queued, bytes(data), self.peer))
+            self.wake.notify()
+        # The sender blocks like it would on a real link once it outruns the line
+        backlog = self.link_free - now
+        if backlog > 0:
+            time.sleep(backlog)
+
+    def deliver(self):
+        while True:
+            with self.wake:
+                while not self.queue or self.queue[0][0] > time.monotonic():
+                    self.wake.wait(self.queue[0][0] - time.monotonic() if self.queue else None)
+                _, _, data, peer = heapq.heappop(self.queue)
+            self.sock.sendto(data, peer)
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.sock], [], [], max(timeout, 0))
+        if not ready:
+            return b""
+        try:
+            data, source = self.sock.recvfrom(65536)
+        except OSError:
+            return b""
+        # A reference receiver answers whoever spoke last, like the device
+        self.peer = source
+        return data
+
+
+def bound_socket(port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+    sock.bind(("127.0.0.1" if port == 0 else "0.0.0.0", port))
+    return sock
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter, epilog=__doc__)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    send = sub.add_parser("send", help="send an image to a device")
+    send.add_argument("host")
+    send.add_argument("image")
+
+    receive = sub.add_parser("receive", help="run the reference receiver on a UDP port")
+    receive.add_argument("output")
+    receive.add_argument("--window", type=int, default=8)
+    receive.add_argument("--chunk", type=int, default=1024)
+
+    loop = sub.add_parser("loopback", help="sender and reference receiver over an emulated link on 127.0.0.1")
+    loop.add_argument("image")
+    loop.add_argument("--loss", type=float, default=0.0, help="probability that a datagram is dropped, each way")
+    loop.add_argument("--delay", type=float, default=0.0, help="one-way latency in ms")
+    loop.add_argument("--jitter", type=float, default=0.0, help="extra random latency in ms, reorders datagrams")
+    loop.add_argument("--window", type=int, default=8)
+    loop.add_argument("--chunk", type=int, default=1024)
+    loop.add_argument("--seed", type=int, default=1)
+
+    for p in (send, receive):
+        p.add_argument("--port", type=int, default=DEFAULT_PORT)
+    for p in (send, loop):
+        p.add_argument("--rate", type=float, default=10.0, help="link rate in Mbit/s (emulated in loopback)")
+        p.add_argument("--force", action="store_true", help="reinstall even if the device already runs this image")
+        p.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    if args.command == "receive":
+        link = Link(bound_socket(args.port))
+        receiver = Receiver(link, args.output, args.window, args.chunk, DatagramParser())
+        print("Receiving on UDP port %d" % args.port)
+        try:
+            receiver.run()
+        except KeyboardInterrupt:
+            pass
+        return
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    rate = args.rate * 1e6 / 8
+    if args.command == "send":
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        link = Link(sock, (socket.gethostbyname(args.host), args.port), rate)
+        receiver = None
+    else:
+        device_sock = bound_socket(0)
+        host_sock = bound_socket(0)
+        emulation = dict(rate=rate, emulate=True, loss=args.loss, delay=args.delay / 1000, jitter=args.jitter / 1000)
+        link = Link(host_sock, device_sock.getsockname(), rng=random.Random(args.seed), **emulation)
+        device_link = Link(device_sock, rng=random.Random(args.seed + 1), **emulation)
+        output = args.image + ".received"
+        receiver = Receiver(device_link, output, args.window, args.chunk, DatagramParser())
+        thread = threading.Thread(target=receiver.run, daemon=True)
+        thread.start()
+
+    sender = Sender(link, image, args.force, args.verbose, DatagramParser())
+    started = time.monotonic()
+    err, outcome = sender.run()
+    elapsed = time.monotonic() - started
+
+    if receiver:
+        receiver.running = False
+        thread.join()
+        if err == 0:
+            with open(output, "rb") as f:
+                if f.read() != image:
+                    sys.exit("Loopback image differs from the original")
+            os.remove(output)
+        print("%d datagrams dropped by the emulated link" % (link.dropped + device_link.dropped))
+    report(sender, image, elapsed, rate if receiver else None, err, outcome)
+
+
+if __name__ == "__main__":
+    main()
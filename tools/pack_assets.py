@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""Pack the web UI in data/ into one indexed asset bundle for simpleOTA.
+
+The bundle is embedded in flash and served as-is by the single asset router
+in apUpdate.c, so adding a file to data/ needs no code or URI handler.
+
+Layout (little endian, every section 4-byte aligned):
+
+    header   magic "OTAB", u16 version, u16 asset_count, u16 table_size,
+             u16 max_probe, u32 bundle_size
+    table    table_size entries of 24 bytes, open addressing on the path hash:
+             u32 path_hash, u32 path_offset, u32 data_offset, u32 data_length,
+             u32 etag, u8 mime, u8 flags, u16 path_length
+    strings  request paths, not NUL terminated
+    data     asset bodies, gzip compressed where that makes them smaller
+
+Keep the constants below in step with components/simpleOTA/include/assetBundle.h.
+"""
+
+import argparse
+import gzip
+import os
+import struct
+import sys
+import time
+
+MAGIC = b"OTAB"
+VERSION = 1
+HEADER_FORMAT = "<4sHHHHI"
+ENTRY_FORMAT = "<IIIIIBBH"
+
+FLAG_USED = 0x01
+FLAG_GZIP = 0x02
+FLAG_TEMPLATE = 0x04
+
+# Index is the mime byte stored per asset, same order as mime_types[] in components/simpleOTA/assetBundle.c
+MIME_TYPES = [
+    ("application/octet-stream", ()),
+    ("text/html", (".html", ".htm")),
+    ("text/css", (".css",)),
+    ("application/javascript", (".js",)),
+    ("image/png", (".png",)),
+    ("image/svg+xml", (".svg",)),
+    ("image/x-icon", (".ico",)),
+    ("application/json", (".json",)),
+    ("text/plain", (".txt",)),
+]
+
+# Already compressed formats are stored raw
+NO_GZIP = (".png", ".ico")
+
+# A lookup never probes more slots than this, the table grows until it fits
+MAX_PROBE = 2
+
+# Served for "/" as well as its own name
+INDEX_FILE = "index.html"
+
+
+def fnv1a(data):
+    h = 0x811C9DC5
+    for b in data:
+        h ^= b
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def mime_for(name):
+    ext = os.path.splitext(name)[1].lower()
+    for index, (_, extensions) in enumerate(MIME_TYPES):
+        if ext in extensions:
+            return index
+    return 0
+
+
+def align4(value):
+    return (value + 3) & ~3
+
+
+def load_assets(source_dir):
+    assets = []
+    for name in sorted(os.listdir(source_dir)):
+        path = os.path.join(source_dir, name)
+        if not os.path.isfile(path) or name.startswith("."):
+            continue
+        with open(path, "rb") as f:
+            raw = f.read()
+
+        flags = FLAG_USED
+        body = raw
+        mime = mime_for(name)
+        if MIME_TYPES[mime][0] == "text/html" and b"{{" in raw:
+            # Placeholders are substituted while streaming, so templates stay plain text
+            flags |= FLAG_TEMPLATE
+        elif not name.lower().endswith(NO_GZIP):
+            packed = gzip.compress(raw, compresslevel=9, mtime=0)
+            if len(packed) < len(raw):
+                body = packed
+                flags |= FLAG_GZIP
+
+        routes = ["/" + name]
+        if name == INDEX_FILE:
+            routes.insert(0, "/")
+        assets.append({"name": name, "routes": routes, "raw": len(raw), "body": body, "flags": flags,
+                       "mime": mime, "etag": fnv1a(body)})
+    return assets
+
+
+def build_table(routes):
+    size = 4
+    while size < len(routes) * 2:
+        size *= 2
+    while True:
+        table = [None] * size
+        worst = 0
+        hashes = set()
+        for route in routes:
+            h = fnv1a(route["path"].encode())
+            if h in hashes:
+                sys.exit("pack_assets: hash collision on %s, rename the file" % route["path"])
+            hashes.add(h)
+            for probe in range(size):
+                slot = (h + probe) & (size - 1)
+                if table[slot] is None:
+                    table[slot] = (h, route)
+                    worst = max(worst, probe + 1)
+                    break
+        if worst <= MAX_PROBE:
+            return table, worst
+        size *= 2
+
+
+def pack(source_dir):
+    assets = load_assets(source_dir)
+    routes = [{"path": p, "asset": a} for a in assets for p in a["routes"]]
+    if not routes:
+        sys.exit("pack_assets: no assets found in %s" % source_dir)
+    table, max_probe = build_table(routes)
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    offset = header_size + entry_size * len(table)
+
+    strings = b""
+    for route in routes:
+        route["path_offset"] = offset + len(strings)
+        strings += route["path"].encode()
+    offset = align4(offset + len(strings))
+    strings += b"\0" * (offset - header_size - entry_size * len(table) - len(strings))
+
+    data = b""
+    for asset in assets:
+        asset["offset"] = offset + len(data)
+        data += asset["body"]
+        data += b"\0" * (align4(len(data)) - len(data))
+    total = offset + len(data)
+
+    entries = b""
+    for slot in table:
+        if slot is None:
+            entries += struct.pack(ENTRY_FORMAT, 0, 0, 0, 0, 0, 0, 0, 0)
+            continue
+        h, route = slot
+        asset = route["asset"]
+        entries += struct.pack(ENTRY_FORMAT, h, route["path_offset"], asset["offset"], len(asset["body"]),
+                               asset["etag"], asset["mime"], asset["flags"], len(route["path"]))
+
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(routes), len(table), max_probe, total)
+    blob = header + entries + strings + data
+    assert len(blob) == total
+    return blob, assets, len(table), max_probe
+
+
+def lookup(blob, path):
+    """Resolve a path the same way assetBundle_find() does."""
+    _, _, _, table_size, max_probe, _ = struct.unpack_from(HEADER_FORMAT, blob, 0)
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    h = fnv1a(path)
+    for probe in range(max_probe):
+        slot = (h + probe) & (table_size - 1)
+        entry = struct.unpack_from(ENTRY_FORMAT, blob, header_size + slot * entry_size)
+        if not entry[6] & FLAG_USED:
+            return None
+        if entry[0] == h and entry[7] == len(path) and blob[entry[1]:entry[1] + entry[7]] == path:
+            return entry
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("source", help="directory holding the UI assets")
+    parser.add_argument("output", nargs="?", help="bundle to write")
+    parser.add_argument("--bench", type=int, metavar="N", help="time N lookups of every route on the host")
+    parser.add_argument("-q", "--quiet", action="store_true")
+    args = parser.parse_args()
+
+    blob, assets, table_size, max_probe = pack(args.source)
+
+    # Every route must resolve to its own body before the bundle is written
+    for asset in assets:
+        for route in asset["routes"]:
+            entry = lookup(blob, route.encode())
+            if entry is None or blob[entry[2]:entry[2] + entry[3]] != asset["body"]:
+                sys.exit("pack_assets: %s does not resolve in the packed bundle" % route)
+
+    if args.output:
+        os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+        with open(args.output, "wb") as f:
+            f.write(blob)
+
+    if not args.quiet:
+        for asset in assets:
+            kind = "gzip" if asset["flags"] & FLAG_GZIP else "template" if asset["flags"] & FLAG_TEMPLATE else "raw"
+            print("  %-16s %7d -> %7d bytes  %-8s %s" % (asset["name"], asset["raw"], len(asset["body"]), kind,
+                                                       MIME_TYPES[asset["mime"]][0]))
+        print("pack_assets: %d assets, %d bytes, %d table slots, max probe %d"
+              % (len(assets), len(blob), table_size, max_probe))
+
+    if args.bench:
+        paths = [r.encode() for a in assets for r in a["routes"]] + [b"/generate_204"]
+        start = time.perf_counter()
+        for _ in range(args.bench):
+            for path in paths:
+                lookup(blob, path)
+        elapsed = time.perf_counter() - start
+        print("pack_assets: %.2f us per lookup on the host" % (elapsed * 1e6 / (args.bench * len(paths))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,173 @@
+#include "http.h"
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HTTP_SEND_SLICE 4096
+#define HTTP_PROGRESS_INTERVAL_MS 100
+// Little is left queued in the kernel, so send time and progress follow what the device
+// has read rather than what fit the socket buffer
+#define HTTP_SEND_BUFFER (32 * 1024)
+
+double http_nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int connect_to(const httpTarget_t *target)
+{
+    char port[8];
+    snprintf(port, sizeof(port), "%d", target->port);
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs;
+    if (getaddrinfo(target->host, port, &hints, &addrs) != 0)
+    {
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo *a = addrs; a && sock < 0; a = a->ai_next)
+    {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock < 0)
+        {
+            continue;
+        }
+        // Bounds connect, every send and every receive
+        struct timeval timeout = {.tv_sec = target->timeout_ms / 1000, .tv_usec = (target->timeout_ms % 1000) * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int send_buffer = HTTP_SEND_BUFFER;
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+        if (connect(sock, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return sock;
+}
+
+static int send_all(int sock, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Status line, Content-Length and body of the reply, body truncated to fit
+static int read_response(int sock, httpResponse_t *response)
+{
+    char head[2048];
+    size_t fill = 0;
+    char *end = NULL;
+    while (!end)
+    {
+        if (fill == sizeof(head) - 1)
+        {
+            return -1;
+        }
+        ssize_t n = recv(sock, head + fill, sizeof(head) - 1 - fill, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        fill += n;
+        head[fill] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+
+    if (sscanf(head, "HTTP/%*d.%*d %d", &response->status) != 1)
+    {
+        return -1;
+    }
+
+    long content_length = -1;
+    for (char *line = strstr(head, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+        {
+            content_length = strtol(line + 17, NULL, 10);
+        }
+    }
+
+    size_t have = fill - (end + 4 - head);
+    size_t cap = sizeof(response->body) - 1;
+    response->body_len = have < cap ? have : cap;
+    memcpy(response->body, end + 4, response->body_len);
+    while (response->body_len < cap && (content_length < 0 || (long)response->body_len < content_length))
+    {
+        ssize_t n = recv(sock, response->body + response->body_len, cap - response->body_len, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        response->body_len += n;
+    }
+    response->body[response->body_len] = '\0';
+    return 0;
+}
+
+int httpClient_request(const httpTarget_t *target, const char *method, const char *path, const char *headers,
+                       const uint8_t *body, size_t body_len, httpResponse_t *response,
+                       httpProgress_t progress, void *ctx)
+{
+    memset(response, 0, sizeof(*response));
+    double start = http_nowMs();
+    int sock = connect_to(target);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    response->connect_ms = http_nowMs() - start;
+
+    char head[1024];
+    int head_len = snprintf(head, sizeof(head),
+                            "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nContent-Length: %zu\r\n%s\r\n",
+                            method, path, target->host, body_len, headers ? headers : "");
+    start = http_nowMs();
+    int err = send_all(sock, (const uint8_t *)head, head_len);
+
+    double last_progress = 0;
+    while (err == 0 && response->sent < body_len)
+    {
+        size_t slice = body_len - response->sent < HTTP_SEND_SLICE ? body_len - response->sent : HTTP_SEND_SLICE;
+        err = send_all(sock, body + response->sent, slice);
+        if (err == 0)
+        {
+            response->sent += slice;
+        }
+        if (progress && (http_nowMs() - last_progress >= HTTP_PROGRESS_INTERVAL_MS || response->sent == body_len))
+        {
+            last_progress = http_nowMs();
+            progress(response->sent, body_len, ctx);
+        }
+    }
+    response->send_ms = http_nowMs() - start;
+
+    // A device that rejects an upload early answers before reading the body, so look for
+    // a response even when sending failed
+    start = http_nowMs();
+    int result = read_response(sock, response);
+    response->wait_ms = http_nowMs() - start;
+    close(sock);
+    return result;
+}
@@ -0,0 +1,39 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HTTP_MAX_RESPONSE_BODY 4096
+
+typedef struct
+{
+    const char *host;
+    int port;
+    int timeout_ms;
+} httpTarget_t;
+
+typedef struct
+{
+    int status; // 0 if no response arrived
+    char body[HTTP_MAX_RESPONSE_BODY];
+    size_t body_len;
+    size_t sent;      // Request body bytes handed to the socket
+    double connect_ms;
+    double send_ms;   // Request head and body
+    double wait_ms;   // Last body byte sent to the response head, the device's verify time for uploads
+} httpResponse_t;
+
+// Called as the body goes out, at most every 100 ms
+typedef void (*httpProgress_t)(size_t sent, size_t total, void *ctx);
+
+// One request on a fresh connection. headers is zero or more "Name: value\r\n" lines.
+// Returns 0 when a response was read, -1 if the connection failed first (see response->sent).
+int httpClient_request(const httpTarget_t *target, const char *method, const char *path, const char *headers,
+                       const uint8_t *body, size_t body_len, httpResponse_t *response,
+                       httpProgress_t progress, void *ctx);
+
+// Monotonic clock in milliseconds
+double http_nowMs(void);
+
+#endif // HTTP_H
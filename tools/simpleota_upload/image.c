@@ -0,0 +1,68 @@
+#include "image.h"
+#include <string.h>
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void read_string(const uint8_t *p, size_t field, char *out)
+{
+    memcpy(out, p, field);
+    out[field] = '\0';
+}
+
+bool imageInfo_parse(const uint8_t *data, size_t len, imageInfo_t *info)
+{
+    if (len < IMAGE_INFO_BYTES || data[0] != IMAGE_HEADER_MAGIC)
+    {
+        return false;
+    }
+    if (data[1] == 0 || data[1] > IMAGE_MAX_SEGMENTS)
+    {
+        return false;
+    }
+
+    const uint8_t *desc = data + IMAGE_APP_DESC_OFFSET;
+    if (read_u32(desc) != IMAGE_APP_DESC_MAGIC)
+    {
+        return false;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->segments = data[1];
+    info->chip_id = (uint16_t)(data[12] | (data[13] << 8));
+    info->hash_appended = data[23] == 1;
+    read_string(desc + 16, 32, info->version);
+    read_string(desc + 48, 32, info->project);
+    read_string(desc + 80, 16, info->time);
+    read_string(desc + 96, 16, info->date);
+    read_string(desc + 112, 32, info->idf);
+    memcpy(info->elf_sha256, desc + 144, sizeof(info->elf_sha256));
+    return true;
+}
+
+const char *imageInfo_chipName(uint16_t chip_id)
+{
+    switch (chip_id)
+    {
+    case 0x0000:
+        return "esp32";
+    case 0x0002:
+        return "esp32s2";
+    case 0x0005:
+        return "esp32c3";
+    case 0x0009:
+        return "esp32s3";
+    case 0x000C:
+        return "esp32c2";
+    case 0x000D:
+        return "esp32c6";
+    case 0x0010:
+        return "esp32h2";
+    case 0x0012:
+        return "esp32p4";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Layout of an ESP-IDF app image: 24 byte image header, 8 byte segment header, then
+// esp_app_desc_t. The same fields the web page's preflight.js reads.
+#define IMAGE_HEADER_MAGIC 0xE9
+#define IMAGE_APP_DESC_OFFSET 32
+#define IMAGE_APP_DESC_MAGIC 0xABCD5432
+#define IMAGE_INFO_BYTES (IMAGE_APP_DESC_OFFSET + 256)
+#define IMAGE_MAX_SEGMENTS 16
+
+typedef struct
+{
+    uint16_t chip_id;
+    uint8_t segments;
+    bool hash_appended;
+    char version[33];
+    char project[33];
+    char idf[33];
+    char date[17];
+    char time[17];
+    uint8_t elf_sha256[32];
+} imageInfo_t;
+
+// Read the headers of an app image, false if data is not one
+bool imageInfo_parse(const uint8_t *data, size_t len, imageInfo_t *info);
+
+// Chip name for an esp_chip_id_t value, "unknown" for ids this tool does not know
+const char *imageInfo_chipName(uint16_t chip_id);
+
+#endif // IMAGE_H
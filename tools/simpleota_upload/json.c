@@ -0,0 +1,98 @@
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Start of the value for path, NULL if not found
+static const char *find_value(const char *json, const char *path)
+{
+    const char *pos = json;
+    while (*path)
+    {
+        const char *dot = strchr(path, '.');
+        size_t key_len = dot ? (size_t)(dot - path) : strlen(path);
+        char key[64];
+        if (key_len + 3 > sizeof(key))
+        {
+            return NULL;
+        }
+        snprintf(key, sizeof(key), "\"%.*s\"", (int)key_len, path);
+
+        pos = strstr(pos, key);
+        if (!pos)
+        {
+            return NULL;
+        }
+        pos += strlen(key);
+        while (*pos == ' ')
+        {
+            pos++;
+        }
+        if (*pos != ':')
+        {
+            return NULL;
+        }
+        pos++;
+        path += key_len + (dot ? 1 : 0);
+    }
+    while (*pos == ' ')
+    {
+        pos++;
+    }
+    return pos;
+}
+
+bool json_getString(const char *json, const char *path, char *out, size_t cap)
+{
+    const char *value = find_value(json, path);
+    if (!value || *value != '"')
+    {
+        return false;
+    }
+    value++;
+    size_t len = 0;
+    while (value[len] && value[len] != '"' && len + 1 < cap)
+    {
+        out[len] = value[len];
+        len++;
+    }
+    out[len] = '\0';
+    return true;
+}
+
+bool json_getNumber(const char *json, const char *path, long long *out)
+{
+    const char *value = find_value(json, path);
+    char *end;
+    if (!value)
+    {
+        return false;
+    }
+    long long number = strtoll(value, &end, 10);
+    if (end == value)
+    {
+        return false;
+    }
+    *out = number;
+    return true;
+}
+
+bool json_getBool(const char *json, const char *path, bool *out)
+{
+    const char *value = find_value(json, path);
+    if (!value)
+    {
+        return false;
+    }
+    if (strncmp(value, "true", 4) == 0)
+    {
+        *out = true;
+        return true;
+    }
+    if (strncmp(value, "false", 5) == 0)
+    {
+        *out = false;
+        return true;
+    }
+    return false;
+}
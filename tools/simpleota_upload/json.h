@@ -0,0 +1,14 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lookups in the device's small, flat JSON replies. path is a dot separated key list
+// ("app.elf_sha256"); each key is searched for after the previous one, which is enough
+// for /info and the upload results. Return false when the key is missing.
+bool json_getString(const char *json, const char *path, char *out, size_t cap);
+bool json_getNumber(const char *json, const char *path, long long *out);
+bool json_getBool(const char *json, const char *path, bool *out);
+
+#endif // JSON_H
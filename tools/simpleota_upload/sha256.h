@@ -0,0 +1,23 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Plain SHA-256 (FIPS 180-4), so the uploader needs no crypto library
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t fill;
+} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+void sha256_update(sha256_t *ctx, const uint8_t *data, size_t len);
+void sha256_final(sha256_t *ctx, uint8_t digest[32]);
+
+// Lower-case hex of a 32 byte digest, out holds 65 bytes
+void sha256_hex(const uint8_t digest[32], char *out);
+
+#endif // SHA256_H
@@ -0,0 +1,655 @@
+// simpleota_upload - upload firmware to a simpleOTA device from the command line
+//
+// Runs the same checks as the web page (main.js and preflight.js) before anything is
+// sent, then POSTs the image to /ota_update. Interrupted uploads resume from the offset
+// the device reports in /info, and images can be sent deflate compressed. Every run
+// ends with per-phase timings and throughput, so it doubles as a benchmark against a
+// device or against tools/ota_standin.py.
+
+#include "http.h"
+#include "image.h"
+#include "json.h"
+#include "sha256.h"
+#include "udp.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define UPLOAD_DEFAULT_HOST "10.0.0.1"
+#define UPLOAD_DEFAULT_PORT 80
+#define UPLOAD_DEFAULT_RETRIES 5
+#define UPLOAD_DEFAULT_TIMEOUT_S 60
+#define UPLOAD_MIN_IMAGE_BYTES (100 * 1024)
+#define UPLOAD_RETRY_DELAY_MS 1000
+
+// Exit codes
+#define EXIT_OK 0       // Installed, staged or already up to date
+#define EXIT_LOCAL 1    // Bad arguments or not a firmware image
+#define EXIT_REJECTED 2 // The device refused the image
+#define EXIT_TRANSFER 3 // The device could not be reached or the upload kept failing
+
+typedef struct
+{
+    httpTarget_t target;
+    const char *path;
+    bool compress;
+    bool force;
+    bool resume;
+    int udp_port; // 0 for HTTP
+    int retries;
+    bool verbose;
+} options_t;
+
+typedef struct
+{
+    bool valid;
+    char project[33];
+    char version[33];
+    char elf_sha256[65];
+    long long chip_id;
+    long long free_slot_size;
+    long long max_upload_size;
+    bool deflate;
+    long long resume_offset;
+    char resume_sha256[65];
+} deviceInfo_t;
+
+// Milliseconds spent in each phase, summed over retries
+typedef struct
+{
+    double read;
+    double parse;
+    double hash;
+    double query;
+    double compress;
+    double transfer;
+    double verify;
+} phases_t;
+
+typedef struct
+{
+    size_t image_sent; // Image bytes carried by the requests, before compression
+    size_t wire_sent;  // Request body bytes actually sent
+    size_t resumed;    // Image bytes the device already held when a request started
+    int attempts;
+} transferStats_t;
+
+static phases_t phases;
+static transferStats_t stats;
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+            "Usage: simpleota_upload [options] IMAGE.bin\n"
+            "\n"
+            "  -H, --host HOST      device address (default " UPLOAD_DEFAULT_HOST ")\n"
+            "  -p, --port PORT      HTTP port (default %d)\n"
+            "  -z, --compress       send the image deflate compressed if the device accepts it\n"
+            "  -f, --force          install even if the device already runs this image\n"
+            "      --no-resume      restart interrupted uploads from the beginning\n"
+            "      --udp[=PORT]     use the UDP transport instead of HTTP (default port %d)\n"
+            "  -r, --retries N      attempts after a failed transfer (default %d)\n"
+            "  -t, --timeout S      network timeout in seconds (default %d)\n"
+            "  -v, --verbose        print device details and every retry\n"
+            "  -h, --help\n"
+            "\n"
+            "Exit status: 0 installed or up to date, 1 bad input, 2 rejected by the device,\n"
+            "3 transfer failed.\n",
+            UPLOAD_DEFAULT_PORT, UDP_DEFAULT_PORT, UPLOAD_DEFAULT_RETRIES, UPLOAD_DEFAULT_TIMEOUT_S);
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+    uint8_t *data = NULL;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+        long size = ftell(f);
+        rewind(f);
+        data = size > 0 ? malloc(size) : NULL;
+        if (data && fread(data, 1, size, f) != (size_t)size)
+        {
+            free(data);
+            data = NULL;
+        }
+        *len = size > 0 ? (size_t)size : 0;
+    }
+    fclose(f);
+    return data;
+}
+
+static bool ends_with_bin(const char *path)
+{
+    size_t len = strlen(path);
+    return len >= 4 && strcasecmp(path + len - 4, ".bin") == 0;
+}
+
+static void sleep_ms(int ms)
+{
+    usleep(ms * 1000);
+}
+
+// "error: details" from a device JSON reply, or the raw body if it is not one
+static void describe_reply(const httpResponse_t *response, char *out, size_t cap)
+{
+    char error[128] = "";
+    char details[160] = "";
+    if (json_getString(response->body, "error", error, sizeof(error)))
+    {
+        json_getString(response->body, "details", details, sizeof(details));
+        snprintf(out, cap, "%s%s%s", error, details[0] ? ": " : "", details);
+    }
+    else
+    {
+        snprintf(out, cap, "%.200s", response->body);
+    }
+}
+
+// Same wording as getDetailedErrorMessage() in main.js
+static void report_status(const httpResponse_t *response)
+{
+    char message[320];
+    describe_reply(response, message, sizeof(message));
+    const char *fallback;
+    switch (response->status)
+    {
+    case 400:
+        fallback = "Invalid firmware file";
+        break;
+    case 409:
+        fallback = "Firmware already installed";
+        break;
+    case 413:
+        fallback = "File too large";
+        break;
+    case 415:
+        fallback = "Compression not supported";
+        break;
+    case 416:
+        fallback = "Cannot resume upload";
+        break;
+    case 500:
+        fallback = "Server error during upload";
+        break;
+    case 503:
+        fallback = "Device busy";
+        break;
+    default:
+        fallback = "Upload failed";
+        break;
+    }
+    fprintf(stderr, "Device answered %d: %s\n", response->status, message[0] ? message : fallback);
+}
+
+static bool query_info(const options_t *options, deviceInfo_t *info)
+{
+    static httpResponse_t response;
+    double started = http_nowMs();
+    memset(info, 0, sizeof(*info));
+    int rc = httpClient_request(&options->target, "GET", "/info", NULL, NULL, 0, &response, NULL, NULL);
+    phases.query += http_nowMs() - started;
+    if (rc != 0 || response.status != 200)
+    {
+        return false;
+    }
+
+    const char *json = response.body;
+    json_getString(json, "app.project", info->project, sizeof(info->project));
+    json_getString(json, "app.version", info->version, sizeof(info->version));
+    json_getString(json, "app.elf_sha256", info->elf_sha256, sizeof(info->elf_sha256));
+    info->chip_id = -1;
+    json_getNumber(json, "chip.chip_id", &info->chip_id);
+    json_getNumber(json, "free_slot_size", &info->free_slot_size);
+    json_getNumber(json, "max_upload_size", &info->max_upload_size);
+    // Older firmware has no "upload" object: no resume, no compression
+    json_getBool(json, "upload.deflate", &info->deflate);
+    json_getNumber(json, "upload.resume_offset", &info->resume_offset);
+    json_getString(json, "upload.resume_sha256", info->resume_sha256, sizeof(info->resume_sha256));
+    info->valid = true;
+    return true;
+}
+
+// Offset to resume from: the device must hold a prefix of this very image
+static size_t resume_offset(const options_t *options, const deviceInfo_t *info, const char *sha_hex, size_t len)
+{
+    if (!options->resume || !info->valid || info->resume_offset <= 0 || (size_t)info->resume_offset >= len ||
+        strcasecmp(info->resume_sha256, sha_hex) != 0)
+    {
+        return 0;
+    }
+    return (size_t)info->resume_offset;
+}
+
+static void show_progress(size_t sent, size_t total, void *ctx)
+{
+    const double *started = ctx;
+    double elapsed = (http_nowMs() - *started) / 1000;
+    fprintf(stderr, "\r  %3d%%  %zu / %zu bytes  %.1f KB/s ", (int)(total ? sent * 100 / total : 100), sent, total,
+            elapsed > 0 ? sent / 1024.0 / elapsed : 0);
+}
+
+// Compressed copy of the image from offset on, NULL when the slice is sent as is
+static uint8_t *prepare_body(const uint8_t *image, size_t offset, size_t len, bool compress, size_t *body_len)
+{
+    *body_len = len - offset;
+#if HAVE_ZLIB
+    if (compress)
+    {
+        double started = http_nowMs();
+        uLongf out_len = compressBound(len - offset);
+        uint8_t *out = malloc(out_len);
+        if (out && compress2(out, &out_len, image + offset, len - offset, Z_BEST_COMPRESSION) == Z_OK)
+        {
+            *body_len = out_len;
+            phases.compress += http_nowMs() - started;
+            return out;
+        }
+        free(out);
+        phases.compress += http_nowMs() - started;
+    }
+#else
+    (void)image;
+    (void)compress;
+#endif
+    return NULL;
+}
+
+static int upload_http(const options_t *options, const uint8_t *image, size_t len, const char *sha_hex,
+                       const imageInfo_t *image_info, deviceInfo_t *info)
+{
+    static httpResponse_t response;
+    bool compress = options->compress && info->deflate;
+    size_t offset = resume_offset(options, info, sha_hex, len);
+
+    for (int attempt = 0; attempt <= options->retries; attempt++)
+    {
+        size_t body_len;
+        uint8_t *compressed = prepare_body(image, offset, len, compress, &body_len);
+        const uint8_t *body = compressed ? compressed : image + offset;
+
+        char path[96];
+        snprintf(path, sizeof(path), "/ota_update?offset=%zu%s", offset, options->force ? "&force=1" : "");
+        char headers[320];
+        snprintf(headers, sizeof(headers),
+                 "Content-Type: application/octet-stream\r\n"
+                 "X-Firmware-SHA256: %s\r\n"
+                 "X-Firmware-Chip-Id: %u\r\n"
+                 "X-Firmware-Size: %zu\r\n"
+                 "%s",
+                 sha_hex, image_info->chip_id, len, compressed ? "Content-Encoding: deflate\r\n" : "");
+
+        if (offset > 0)
+        {
+            printf("Resuming at byte %zu of %zu\n", offset, len);
+        }
+        printf("Uploading %zu bytes%s to %s:%d\n", body_len, compressed ? " (deflate)" : "", options->target.host,
+               options->target.port);
+
+        double started = http_nowMs();
+        bool tty = isatty(STDERR_FILENO);
+        int rc = httpClient_request(&options->target, "POST", path, headers, body, body_len, &response,
+                                    tty ? show_progress : NULL, &started);
+        if (tty)
+        {
+            fprintf(stderr, "\n");
+        }
+        phases.transfer += response.connect_ms + response.send_ms;
+        phases.verify += response.wait_ms;
+        stats.attempts++;
+        stats.wire_sent += response.sent;
+        // Share of the image the sent bytes carried, exact when uncompressed
+        stats.image_sent += body_len ? (size_t)((double)response.sent / body_len * (len - offset)) : 0;
+        stats.resumed += offset;
+        free(compressed);
+
+        if (rc == 0 && response.status == 200)
+        {
+            char status[16] = "";
+            json_getString(response.body, "status", status, sizeof(status));
+            if (strcmp(status, "staged") == 0)
+            {
+                char partition[17] = "";
+                json_getString(response.body, "partition", partition, sizeof(partition));
+                printf("Firmware staged in %s, activate it with POST /activate\n", partition);
+            }
+            else
+            {
+                printf("Firmware installed, device is rebooting\n");
+            }
+            return EXIT_OK;
+        }
+
+        if (rc == 0 && response.status == 409)
+        {
+            report_status(&response);
+            printf("Device already runs this image, use --force to reinstall\n");
+            return EXIT_OK;
+        }
+
+        if (rc == 0 && response.status == 416)
+        {
+            // The device dropped or replaced the interrupted session, ask what it holds now
+            if (options->verbose)
+            {
+                report_status(&response);
+            }
+            offset = query_info(options, info) ? resume_offset(options, info, sha_hex, len) : 0;
+            continue;
+        }
+
+        bool lost = rc != 0 || (response.status == 500 && strstr(response.body, "File reception failed"));
+        if (!lost)
+        {
+            report_status(&response);
+            return EXIT_REJECTED;
+        }
+
+        fprintf(stderr, "Upload interrupted after %zu bytes%s\n", response.sent,
+                attempt < options->retries ? ", retrying" : "");
+        if (attempt == options->retries)
+        {
+            break;
+        }
+        sleep_ms(UPLOAD_RETRY_DELAY_MS);
+
+        // The device keeps what it wrote; /info says how much
+        offset = 0;
+        if (options->resume && query_info(options, info))
+        {
+            offset = resume_offset(options, info, sha_hex, len);
+        }
+    }
+    return EXIT_TRANSFER;
+}
+
+static int upload_udp(const options_t *options, const uint8_t *image, size_t len, const uint8_t sha256[32])
+{
+    udpStats_t udp;
+    udpResult_t result = {0};
+    printf("Sending %zu bytes over UDP to %s:%d\n", len, options->target.host, options->udp_port);
+    int rc = udpSender_send(options->target.host, options->udp_port, image, len, sha256, options->force,
+                            options->verbose, &udp, &result);
+    phases.transfer += udp.send_ms;
+    phases.verify += udp.verify_ms;
+    stats.attempts = 1;
+    stats.wire_sent = udp.frames_sent ? len : 0;
+    stats.image_sent = stats.wire_sent;
+    if (udp.frames_sent)
+    {
+        printf("Window %u x %u bytes, %u frames sent, %u retransmitted, %u timeouts\n", udp.window, udp.chunk,
+               udp.frames_sent, udp.retransmits, udp.timeouts);
+    }
+
+    if (rc != 0)
+    {
+        fprintf(stderr, "No answer from the device's UDP transport\n");
+        return EXIT_TRANSFER;
+    }
+    if (result.err != 0)
+    {
+        // OTA_PULL_ERR_UP_TO_DATE is the transport's 409
+        fprintf(stderr, "Device refused the image, error 0x%x\n", (unsigned)result.err);
+        return EXIT_REJECTED;
+    }
+    printf(result.outcome == 2 ? "Firmware installed, device is rebooting\n" : "Firmware staged\n");
+    return EXIT_OK;
+}
+
+static void print_report(size_t len, double total_ms)
+{
+    printf("\nPhase timings (ms)\n");
+    printf("  read      %9.1f\n", phases.read);
+    printf("  parse     %9.1f\n", phases.parse);
+    printf("  hash      %9.1f\n", phases.hash);
+    printf("  query     %9.1f\n", phases.query);
+    printf("  compress  %9.1f\n", phases.compress);
+    printf("  transfer  %9.1f\n", phases.transfer);
+    printf("  verify    %9.1f\n", phases.verify);
+    printf("  total     %9.1f\n", total_ms);
+
+    if (stats.attempts == 0 || phases.transfer <= 0)
+    {
+        return;
+    }
+    double seconds = phases.transfer / 1000;
+    printf("\nThroughput\n");
+    printf("  image     %9.1f KB/s (%zu bytes)\n", stats.image_sent / 1024.0 / seconds, stats.image_sent);
+    printf("  wire      %9.1f KB/s (%zu bytes)\n", stats.wire_sent / 1024.0 / seconds, stats.wire_sent);
+    if (stats.wire_sent > 0 && stats.wire_sent != stats.image_sent)
+    {
+        printf("  ratio     %9.2f (image / wire)\n", (double)stats.image_sent / stats.wire_sent);
+    }
+    printf("  end to end%9.1f KB/s (%zu byte image, %d attempt%s)\n", len / 1024.0 / (total_ms / 1000), len,
+           stats.attempts, stats.attempts == 1 ? "" : "s");
+    if (stats.resumed > 0)
+    {
+        printf("  resumed   %9zu bytes not sent again\n", stats.resumed);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options_t options = {
+        .target = {.host = UPLOAD_DEFAULT_HOST, .port = UPLOAD_DEFAULT_PORT, .timeout_ms = UPLOAD_DEFAULT_TIMEOUT_S * 1000},
+        .resume = true,
+        .retries = UPLOAD_DEFAULT_RETRIES,
+    };
+
+    enum
+    {
+        OPT_NO_RESUME = 256,
+        OPT_UDP,
+    };
+    static const struct option long_options[] = {
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"compress", no_argument, NULL, 'z'},
+        {"force", no_argument, NULL, 'f'},
+        {"no-resume", no_argument, NULL, OPT_NO_RESUME},
+        {"udp", optional_argument, NULL, OPT_UDP},
+        {"retries", required_argument, NULL, 'r'},
+        {"timeout", required_argument, NULL, 't'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:zfr:t:vh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            options.target.host = optarg;
+            break;
+        case 'p':
+            options.target.port = atoi(optarg);
+            break;
+        case 'z':
+            options.compress = true;
+            break;
+        case 'f':
+            options.force = true;
+            break;
+        case OPT_NO_RESUME:
+            options.resume = false;
+            break;
+        case OPT_UDP:
+            options.udp_port = optarg ? atoi(optarg) : UDP_DEFAULT_PORT;
+            break;
+        case 'r':
+            options.retries = atoi(optarg);
+            break;
+        case 't':
+            options.target.timeout_ms = atoi(optarg) * 1000;
+            break;
+        case 'v':
+            options.verbose = true;
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_OK;
+        default:
+            usage(stderr);
+            return EXIT_LOCAL;
+        }
+    }
+    if (optind != argc - 1 || options.target.port <= 0 || options.target.timeout_ms <= 0 || options.retries < 0)
+    {
+        usage(stderr);
+        return EXIT_LOCAL;
+    }
+    options.path = argv[optind];
+    // Keep results and warnings in order when both go to a log
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+#if !HAVE_ZLIB
+    if (options.compress)
+    {
+        fprintf(stderr, "Built without zlib, sending uncompressed\n");
+        options.compress = false;
+    }
+#endif
+    if (options.udp_port && options.compress)
+    {
+        fprintf(stderr, "The UDP transport takes no compressed images, sending uncompressed\n");
+        options.compress = false;
+    }
+
+    double started = http_nowMs();
+
+    // Same checks as validateFile() in main.js
+    size_t len = 0;
+    uint8_t *image = read_file(options.path, &len);
+    phases.read = http_nowMs() - started;
+    if (!image)
+    {
+        fprintf(stderr, "Cannot read %s\n", options.path);
+        return EXIT_LOCAL;
+    }
+    if (!ends_with_bin(options.path))
+    {
+        fprintf(stderr, "File must have .bin extension\n");
+        free(image);
+        return EXIT_LOCAL;
+    }
+    if (len < UPLOAD_MIN_IMAGE_BYTES)
+    {
+        fprintf(stderr, "File too small (minimum 100KB) - not valid firmware\n");
+        free(image);
+        return EXIT_LOCAL;
+    }
+
+    double phase_start = http_nowMs();
+    imageInfo_t image_info;
+    bool parsed = imageInfo_parse(image, len, &image_info);
+    phases.parse = http_nowMs() - phase_start;
+    if (!parsed)
+    {
+        fprintf(stderr, "%s is not an ESP-IDF app image\n", options.path);
+        free(image);
+        return EXIT_LOCAL;
+    }
+
+    phase_start = http_nowMs();
+    sha256_t sha;
+    uint8_t digest[32];
+    sha256_init(&sha);
+    sha256_update(&sha, image, len);
+    sha256_final(&sha, digest);
+    char sha_hex[65];
+    char elf_hex[65];
+    sha256_hex(digest, sha_hex);
+    sha256_hex(image_info.elf_sha256, elf_hex);
+    phases.hash = http_nowMs() - phase_start;
+
+    printf("%s: %s %s for %s, %zu bytes\n", options.path, image_info.project, image_info.version,
+           imageInfo_chipName(image_info.chip_id), len);
+    if (options.verbose)
+    {
+        printf("  built %s %s with %s, %u segments\n  sha256 %s\n  elf    %s\n", image_info.date, image_info.time,
+               image_info.idf, image_info.segments, sha_hex, elf_hex);
+    }
+
+    // Same comparison as the web page makes with /info before uploading
+    deviceInfo_t info;
+    int result;
+    if (!query_info(&options, &info))
+    {
+        if (!options.udp_port)
+        {
+            fprintf(stderr, "Cannot read http://%s:%d/info\n", options.target.host, options.target.port);
+            free(image);
+            return EXIT_TRANSFER;
+        }
+        fprintf(stderr, "No /info from the device, sending without pre-flight checks\n");
+    }
+
+    if (info.valid)
+    {
+        if (options.verbose)
+        {
+            printf("Device runs %s %s, chip id %lld, %lld byte slot\n", info.project, info.version, info.chip_id,
+                   info.free_slot_size);
+        }
+        if (info.chip_id >= 0 && info.chip_id != image_info.chip_id)
+        {
+            fprintf(stderr, "Wrong chip: image is for %s, device is chip id %lld\n",
+                    imageInfo_chipName(image_info.chip_id), info.chip_id);
+            free(image);
+            return EXIT_REJECTED;
+        }
+        long long limit = info.max_upload_size;
+        if (info.free_slot_size > 0 && (limit <= 0 || info.free_slot_size < limit))
+        {
+            limit = info.free_slot_size;
+        }
+        if (limit > 0 && (long long)len > limit)
+        {
+            fprintf(stderr, "File too large: %zu bytes, the device takes at most %lld\n", len, limit);
+            free(image);
+            return EXIT_REJECTED;
+        }
+        if (!options.force && strcasecmp(info.elf_sha256, elf_hex) == 0)
+        {
+            printf("Device already runs this image, use --force to reinstall\n");
+            free(image);
+            print_report(len, http_nowMs() - started);
+            return EXIT_OK;
+        }
+        if (info.project[0] && strcmp(info.project, image_info.project) != 0)
+        {
+            fprintf(stderr, "Warning: device runs project \"%s\", image is \"%s\"\n", info.project,
+                    image_info.project);
+        }
+        if (options.compress && !info.deflate)
+        {
+            fprintf(stderr, "Device does not accept compressed uploads, sending uncompressed\n");
+        }
+    }
+
+    if (options.udp_port)
+    {
+        result = upload_udp(&options, image, len, digest);
+    }
+    else
+    {
+        result = upload_http(&options, image, len, sha_hex, &image_info, &info);
+    }
+
+    print_report(len, http_nowMs() - started);
+    free(image);
+    return result;
+}
@@ -0,0 +1,360 @@
+#include "udp.h"
+#include "http.h"
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define FRAME_SYNC0 0xA5
+#define FRAME_SYNC1 0x5A
+#define FRAME_HEADER_BYTES 10
+#define FRAME_OVERHEAD (FRAME_HEADER_BYTES + 4)
+#define FRAME_MAX_PAYLOAD 4096
+
+enum
+{
+    FRAME_START = 1,
+    FRAME_READY,
+    FRAME_DATA,
+    FRAME_ACK,
+    FRAME_END,
+    FRAME_RESULT,
+    FRAME_ABORT,
+};
+
+#define START_FLAG_SHA256 0x01
+#define START_FLAG_FORCE 0x02
+
+// Link rate assumed for timers only; the window, not this, limits the send rate
+#define UDP_NOMINAL_BYTES_PER_S (10e6 / 8)
+#define UDP_HANDSHAKE_TRIES 40
+#define UDP_HANDSHAKE_WAIT_MS 250
+#define UDP_END_TRIES 40
+#define UDP_STALL_MS 20000
+
+typedef struct
+{
+    uint8_t type;
+    uint32_t seq;
+    const uint8_t *payload;
+    uint16_t length;
+} frame_t;
+
+static uint32_t crc32_table[256];
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    if (crc32_table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            crc32_table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--)
+    {
+        crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+typedef struct
+{
+    int sock;
+    uint8_t frame[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+    uint8_t reply[256];
+    udpStats_t *stats;
+} link_t;
+
+static void send_frame(link_t *link, uint8_t type, uint32_t seq, const uint8_t *payload, uint16_t len)
+{
+    uint8_t *f = link->frame;
+    f[0] = FRAME_SYNC0;
+    f[1] = FRAME_SYNC1;
+    f[2] = type;
+    f[3] = 0;
+    put_u32(f + 4, seq);
+    f[8] = len;
+    f[9] = len >> 8;
+    memcpy(f + FRAME_HEADER_BYTES, payload, len);
+    put_u32(f + FRAME_HEADER_BYTES + len, crc32(f + 2, FRAME_HEADER_BYTES - 2 + len));
+    send(link->sock, f, FRAME_OVERHEAD + len, 0);
+    link->stats->frames_sent++;
+}
+
+// Next valid frame within timeout_ms, false on timeout. Corrupt datagrams are skipped.
+static bool receive_frame(link_t *link, double timeout_ms, frame_t *frame)
+{
+    double deadline = http_nowMs() + timeout_ms;
+    for (;;)
+    {
+        double left = deadline - http_nowMs();
+        struct pollfd pfd = {.fd = link->sock, .events = POLLIN};
+        if (poll(&pfd, 1, left > 0 ? (int)(left + 0.999) : 0) <= 0)
+        {
+            return false;
+        }
+        ssize_t n = recv(link->sock, link->reply, sizeof(link->reply), 0);
+        const uint8_t *r = link->reply;
+        if (n < FRAME_OVERHEAD || r[0] != FRAME_SYNC0 || r[1] != FRAME_SYNC1)
+        {
+            continue;
+        }
+        uint16_t length = r[8] | (r[9] << 8);
+        if (length + FRAME_OVERHEAD != n || crc32(r + 2, n - 6) != get_u32(r + n - 4))
+        {
+            continue;
+        }
+        frame->type = r[2];
+        frame->seq = get_u32(r + 4);
+        frame->payload = r + FRAME_HEADER_BYTES;
+        frame->length = length;
+        return true;
+    }
+}
+
+static int open_link(const char *host, int port)
+{
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *addrs;
+    if (getaddrinfo(host, port_str, &hints, &addrs) != 0)
+    {
+        return -1;
+    }
+    int sock = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (sock >= 0 && connect(sock, addrs->ai_addr, addrs->ai_addrlen) != 0)
+    {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(addrs);
+    return sock;
+}
+
+static void read_result(const frame_t *frame, udpResult_t *result)
+{
+    result->err = frame->length >= 5 ? (int32_t)get_u32(frame->payload) : -1;
+    result->outcome = frame->length >= 5 ? frame->payload[4] : 0;
+}
+
+static int handshake(link_t *link, size_t len, const uint8_t sha256[32], bool force, udpResult_t *result)
+{
+    uint8_t start[38] = {0};
+    put_u32(start, (uint32_t)len);
+    start[4] = START_FLAG_SHA256 | (force ? START_FLAG_FORCE : 0);
+    memcpy(start + 6, sha256, 32);
+
+    for (int attempt = 0; attempt < UDP_HANDSHAKE_TRIES; attempt++)
+    {
+        double sent = http_nowMs();
+        send_frame(link, FRAME_START, 0, start, sizeof(start));
+        frame_t frame;
+        while (receive_frame(link, UDP_HANDSHAKE_WAIT_MS - (http_nowMs() - sent), &frame))
+        {
+            if (frame.type == FRAME_READY && frame.length >= 4)
+            {
+                link->stats->rtt_ms = http_nowMs() - sent;
+                link->stats->window = frame.payload[0] | (frame.payload[1] << 8);
+                link->stats->chunk = frame.payload[2] | (frame.payload[3] << 8);
+                return 1;
+            }
+            if (frame.type == FRAME_RESULT)
+            {
+                read_result(&frame, result);
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+int udpSender_send(const char *host, int port, const uint8_t *image, size_t len, const uint8_t sha256[32],
+                   bool force, bool verbose, udpStats_t *stats, udpResult_t *result)
+{
+    memset(stats, 0, sizeof(*stats));
+    link_t link = {.stats = stats};
+    link.sock = open_link(host, port);
+    if (link.sock < 0)
+    {
+        return -1;
+    }
+
+    double started = http_nowMs();
+    int ready = handshake(&link, len, sha256, force, result);
+    if (ready <= 0)
+    {
+        close(link.sock);
+        return ready;
+    }
+    if (stats->window == 0 || stats->window > 32 || stats->chunk == 0 || stats->chunk > FRAME_MAX_PAYLOAD)
+    {
+        close(link.sock);
+        return -1;
+    }
+
+    uint32_t window = stats->window;
+    uint32_t count = (uint32_t)((len + stats->chunk - 1) / stats->chunk);
+    double frame_ms = (stats->chunk + FRAME_OVERHEAD) * 1000.0 / UDP_NOMINAL_BYTES_PER_S;
+    // A full window, its ACKs and the round trip; doubled on every timeout without progress
+    double base_rto = window * frame_ms + 2 * stats->rtt_ms + 5;
+    double rto = base_rto;
+    // A gap is only resent once a chunk sent this much later has arrived (RACK's reordering window)
+    double reorder_ms = stats->rtt_ms / 4;
+    if (verbose)
+    {
+        printf("Device window %u x %u bytes, %u chunks, rtt %.1f ms\n", window, stats->chunk, count, stats->rtt_ms);
+    }
+
+    uint32_t *order = calloc(count, sizeof(uint32_t)); // Send order of each chunk's latest copy
+    double *sent_at = calloc(count, sizeof(double));
+    if (!order || !sent_at)
+    {
+        free(order);
+        free(sent_at);
+        close(link.sock);
+        return -1;
+    }
+
+    uint32_t counter = 0;
+    uint32_t base = 0;
+    uint32_t next_new = 0;
+    double last_progress = http_nowMs();
+    int status = -1;
+
+#define TRANSMIT(index)                                                                     \
+    do                                                                                      \
+    {                                                                                       \
+        uint32_t i_ = (index);                                                              \
+        size_t off_ = (size_t)i_ * stats->chunk;                                            \
+        size_t n_ = len - off_ < stats->chunk ? len - off_ : stats->chunk;                  \
+        order[i_] = ++counter;                                                              \
+        sent_at[i_] = http_nowMs();                                                         \
+        send_frame(&link, FRAME_DATA, i_, image + off_, (uint16_t)n_);                      \
+    } while (0)
+
+    while (base < count)
+    {
+        while (next_new < count && next_new < base + window)
+        {
+            TRANSMIT(next_new);
+            next_new++;
+        }
+
+        frame_t frame;
+        bool got = receive_frame(&link, rto, &frame);
+        if (got && frame.type == FRAME_RESULT)
+        {
+            read_result(&frame, result);
+            status = 0;
+            goto done;
+        }
+        if (got && frame.type == FRAME_ACK && frame.length >= 4)
+        {
+            uint32_t bitmap = get_u32(frame.payload);
+            if (frame.seq > base)
+            {
+                base = frame.seq;
+                last_progress = http_nowMs();
+                rto = base_rto;
+            }
+            if (bitmap && frame.seq < count)
+            {
+                // A chunk sent before the newest one the device holds is lost, send it again
+                uint32_t newest = 0;
+                uint32_t highest = 0;
+                for (uint32_t i = 0; i < 32 && frame.seq + 1 + i < count; i++)
+                {
+                    uint32_t held = frame.seq + 1 + i;
+                    if (bitmap & (1u << i))
+                    {
+                        highest = held;
+                        if (order[held] > order[newest])
+                        {
+                            newest = held;
+                        }
+                    }
+                }
+                for (uint32_t index = base; index < highest; index++)
+                {
+                    bool held = index > frame.seq && (bitmap & (1u << (index - frame.seq - 1)));
+                    if (!held && order[index] < order[newest] && sent_at[newest] - sent_at[index] >= reorder_ms)
+                    {
+                        stats->retransmits++;
+                        TRANSMIT(index);
+                    }
+                }
+            }
+            continue;
+        }
+        if (!got && base < count && http_nowMs() - last_progress > rto)
+        {
+            if (rto > UDP_STALL_MS)
+            {
+                fprintf(stderr, "Device stopped acknowledging at chunk %u of %u\n", base, count);
+                goto done;
+            }
+            stats->timeouts++;
+            stats->retransmits++;
+            TRANSMIT(base);
+            last_progress = http_nowMs();
+            rto *= 2;
+        }
+    }
+#undef TRANSMIT
+    stats->send_ms = http_nowMs() - started;
+
+    // Every chunk is acknowledged; the device verifies and commits the image, then answers
+    // every END that queued up meanwhile
+    double verify_start = http_nowMs();
+    for (int attempt = 0; attempt < UDP_END_TRIES && status != 0; attempt++)
+    {
+        send_frame(&link, FRAME_END, count, NULL, 0);
+        frame_t frame;
+        double sent = http_nowMs();
+        double wait = rto > 250 ? rto : 250;
+        while (receive_frame(&link, wait - (http_nowMs() - sent), &frame))
+        {
+            if (frame.type == FRAME_RESULT)
+            {
+                read_result(&frame, result);
+                status = 0;
+                break;
+            }
+        }
+    }
+    stats->verify_ms = http_nowMs() - verify_start;
+
+done:
+    if (stats->send_ms == 0)
+    {
+        stats->send_ms = http_nowMs() - started;
+    }
+    free(order);
+    free(sent_at);
+    close(link.sock);
+    return status;
+}
@@ -0,0 +1,37 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Sender for the windowed protocol in components/simpleOTA/include/otaWindow.h, one frame
+// per datagram, as spoken by the device's UDP transport (CONFIG_SIMPLE_OTA_UDP) and by
+// tools/ota_udp_send.py. Keep the three in step.
+
+#define UDP_DEFAULT_PORT 3232
+
+typedef struct
+{
+    uint16_t window;
+    uint16_t chunk;
+    double rtt_ms;
+    uint32_t frames_sent;
+    uint32_t retransmits;
+    uint32_t timeouts;
+    double send_ms;   // START to the last chunk acknowledged
+    double verify_ms; // END to RESULT
+} udpStats_t;
+
+typedef struct
+{
+    int32_t err;     // esp_err_t from the device, 0 on success
+    uint8_t outcome; // 0 failed, 1 staged, 2 activated
+} udpResult_t;
+
+// Send image and wait for the device's verdict. Returns 0 when a result arrived,
+// -1 if the device did not answer or stopped acknowledging.
+int udpSender_send(const char *host, int port, const uint8_t *image, size_t len, const uint8_t sha256[32],
+                   bool force, bool verbose, udpStats_t *stats, udpResult_t *result);
+
+#endif // UDP_H